@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// oneAPI headers
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#include <sycl/sycl.hpp>
+
+#include "exception_handler.hpp"
+#include "json_parser.hpp"
+#include "mapped_file.hpp"
+#include "taped_json.hpp"
+
+/// Documents read ahead of the parsers at most, which bounds the memory held by documents waiting to be parsed.
+constexpr auto MAX_READ_AHEAD = size_t{16};
+
+/**
+ * Queue between the threads of the batch driver. Consumers wait while it is empty and producers while it is full, until
+ * it is closed.
+ */
+template <typename T> class BlockingQueue {
+  public:
+	explicit BlockingQueue(const size_t capacity) : _capacity(capacity) {}
+
+	/// Add an item once there is room for it.
+	void push(T item) {
+		auto lock = std::unique_lock<std::mutex>{_mutex};
+		_not_full.wait(lock, [&]() { return _items.size() < _capacity; });
+		_items.push(std::move(item));
+		_not_empty.notify_one();
+	}
+
+	/// Take the next item, or nothing once the queue is closed and empty.
+	std::optional<T> pop() {
+		auto lock = std::unique_lock<std::mutex>{_mutex};
+		_not_empty.wait(lock, [&]() { return !_items.empty() || _is_closed; });
+		if (_items.empty()) {
+			return std::nullopt;
+		}
+		auto item = std::move(_items.front());
+		_items.pop();
+		_not_full.notify_one();
+		return item;
+	}
+
+	/// Let consumers finish once they took the remaining items.
+	void close() {
+		const auto lock = std::lock_guard<std::mutex>{_mutex};
+		_is_closed = true;
+		_not_empty.notify_all();
+	}
+
+  private:
+	size_t _capacity;
+	std::queue<T> _items;
+	bool _is_closed = false;
+	std::mutex _mutex;
+	std::condition_variable _not_empty;
+	std::condition_variable _not_full;
+};
+
+struct BatchOptions {
+	/// Threads reading files ahead of the parsers.
+	size_t reader_count = 2;
+	/// Parsers, each with buffers and a thread of its own. While one of them runs the pipeline, the others copy
+	/// their input or assemble their documents.
+	size_t parser_count = 2;
+	/// Threads every parser collects its output with, see JsonParser::set_host_thread_count().
+	size_t host_thread_count = 1;
+	Backend backend = Backend::Device;
+	std::vector<std::string> filenames;
+};
+
+/// A file mapped into memory, waiting for a parser.
+struct BatchDocument {
+	size_t index;
+	MappedFile input;
+};
+
+/// What parsing a single file of the batch resulted in.
+struct BatchResult {
+	size_t bytes;
+	size_t node_count;
+	size_t string_count;
+	std::chrono::nanoseconds parse_time;
+	/// Why the file could not be read or parsed, empty on success.
+	std::string error;
+};
+
+static void print_usage(const char *program) {
+	std::cerr << "Usage: " << program << " [--readers N] [--parsers N] [--threads N] [--host] FILE_OR_DIRECTORY...\n"
+			  << "Parses every file, and every file in every directory, keeping several documents in flight.\n";
+}
+
+/// Add a file, or all files of a directory in alphabetical order.
+static void add_path(const std::filesystem::path &path, std::vector<std::string> &filenames) {
+	if (!std::filesystem::is_directory(path)) {
+		filenames.push_back(path.string());
+		return;
+	}
+	auto directory_filenames = std::vector<std::string>{};
+	for (const auto &entry : std::filesystem::directory_iterator{path}) {
+		if (entry.is_regular_file() && entry.path().filename().string()[0] != '.') {
+			directory_filenames.push_back(entry.path().string());
+		}
+	}
+	std::sort(directory_filenames.begin(), directory_filenames.end());
+	filenames.insert(filenames.end(), directory_filenames.begin(), directory_filenames.end());
+}
+
+/// Parse a positive count, nothing if the argument is anything else.
+static std::optional<size_t> parse_count(const std::string_view argument) {
+	auto count = size_t{0};
+	const auto [end, error] = std::from_chars(argument.data(), argument.data() + argument.size(), count);
+	if (error != std::errc{} || end != argument.data() + argument.size() || count == 0) {
+		return std::nullopt;
+	}
+	return count;
+}
+
+/// Parse the command line, nothing if it is malformed.
+static std::optional<BatchOptions> parse_options(const int argc, char **argv) {
+	auto options = BatchOptions{};
+	for (auto index = 1; index < argc; ++index) {
+		const auto argument = std::string{argv[index]};
+		if (argument == "--host") {
+			options.backend = Backend::Host;
+		} else if (argument == "--readers" || argument == "--parsers" || argument == "--threads") {
+			if (index + 1 == argc) {
+				return std::nullopt;
+			}
+			const auto count = parse_count(argv[++index]);
+			if (!count) {
+				return std::nullopt;
+			}
+			if (argument == "--readers") {
+				options.reader_count = *count;
+			} else if (argument == "--parsers") {
+				options.parser_count = *count;
+			} else {
+				options.host_thread_count = *count;
+			}
+		} else {
+			add_path(argument, options.filenames);
+		}
+	}
+	if (options.filenames.empty()) {
+		return std::nullopt;
+	}
+	return options;
+}
+
+/**
+ * Parse all files of the batch. Readers map the files ahead of the parsers, which take turns on the device: one of
+ * them runs the pipeline while the others copy their next input or assemble their documents, so the device never
+ * waits for the host between two documents.
+ * @return One result per file, in the order of the files.
+ */
+static std::vector<BatchResult> parse_batch(sycl::queue &q, const BatchOptions &options) {
+	auto results = std::vector<BatchResult>(options.filenames.size());
+	auto documents = BlockingQueue<BatchDocument>{MAX_READ_AHEAD};
+
+	auto next_file = std::atomic<size_t>{0};
+	auto readers = std::vector<std::thread>{};
+	for (auto reader_index = size_t{0}; reader_index < options.reader_count; ++reader_index) {
+		readers.emplace_back([&]() {
+			for (auto index = next_file++; index < options.filenames.size(); index = next_file++) {
+				try {
+					// Populating the mapping reads the file on this thread rather than on the parser's.
+					auto input = MappedFile{options.filenames[index], MapOptions{true}};
+					results[index].bytes = input.size();
+					documents.push({index, std::move(input)});
+				} catch (const std::exception &e) {
+					results[index].error = e.what();
+				}
+			}
+		});
+	}
+
+	auto pipeline_mutex = std::mutex{};
+	auto parsers = std::vector<std::thread>{};
+	for (auto parser_index = size_t{0}; parser_index < options.parser_count; ++parser_index) {
+		parsers.emplace_back([&]() {
+			auto parser = JsonParser{q, options.backend};
+			parser.set_host_thread_count(options.host_thread_count);
+			parser.set_pipeline_mutex(&pipeline_mutex);
+			while (auto document = documents.pop()) {
+				auto &result = results[document->index];
+				const auto start_time = std::chrono::steady_clock::now();
+				// Any failure, e.g. of the device, only fails this document. An exception leaving the thread would
+				// terminate the whole batch.
+				try {
+					const auto json = parser.parse(document->input);
+					result.node_count = json.node_count();
+					result.string_count = json.string_count();
+				} catch (const std::exception &e) {
+					result.error = e.what();
+				}
+				result.parse_time = std::chrono::steady_clock::now() - start_time;
+			}
+		});
+	}
+
+	for (auto &reader : readers) {
+		reader.join();
+	}
+	documents.close();
+	for (auto &parser : parsers) {
+		parser.join();
+	}
+	return results;
+}
+
+int main(int argc, char **argv) {
+	const auto options = parse_options(argc, argv);
+	if (!options) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	try {
+#if FPGA_SIMULATOR
+		auto selector = sycl::ext::intel::fpga_simulator_selector_v;
+#elif FPGA_HARDWARE
+		auto selector = sycl::ext::intel::fpga_selector_v;
+#else // #if FPGA_EMULATOR
+		auto selector = sycl::ext::intel::fpga_emulator_selector_v;
+#endif
+		sycl::queue q(selector, fpga_tools::exception_handler);
+		std::cout << "Running on device: " << q.get_device().get_info<sycl::info::device::name>().c_str() << std::endl;
+
+		const auto start_time = std::chrono::steady_clock::now();
+		const auto results = parse_batch(q, *options);
+		const auto total_time = std::chrono::duration<double>{std::chrono::steady_clock::now() - start_time};
+
+		auto parsed_count = size_t{0};
+		auto parsed_bytes = size_t{0};
+		for (auto index = size_t{0}; index < results.size(); ++index) {
+			const auto &result = results[index];
+			std::cout << options->filenames[index] << ": ";
+			if (!result.error.empty()) {
+				std::cout << "error: " << result.error << "\n";
+				continue;
+			}
+			std::cout << result.bytes << " bytes, " << result.node_count << " nodes, " << result.string_count
+					  << " strings in " << std::chrono::duration<double, std::milli>{result.parse_time}.count()
+					  << " ms\n";
+			++parsed_count;
+			parsed_bytes += result.bytes;
+		}
+		std::cout << "Parsed " << parsed_count << " of " << results.size() << " files, " << parsed_bytes << " bytes in "
+				  << total_time.count() << " s (" << parsed_bytes / total_time.count() / 1e6 << " MB/s)" << std::endl;
+		return parsed_count == results.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+	} catch (sycl::exception const &e) {
+		std::cerr << "Caught a SYCL host exception:\n" << e.what() << "\n";
+		if (e.code().value() == CL_DEVICE_NOT_FOUND) {
+			std::cerr << "If you are targeting an FPGA, please ensure that your system has a correctly configured FPGA "
+						 "board, or parse on the host with --host.\n";
+		}
+		std::terminate();
+	}
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Size of a document, used to turn the time per iteration into throughputs that are comparable across files and
+ * parsers. Counted the same way for every parser, following the layout of TapedJson.
+ */
+struct DocumentCounts {
+	size_t bytes;
+	/// Values, keys and closing brackets, i.e. the nodes of the tape except for the root node.
+	size_t tokens;
+	/// Keys and string values.
+	size_t strings;
+	/// Nodes of the tape, the tokens and the root node in front of them.
+	size_t tape_nodes;
+};
+
+/// Report the bytes processed and the tokens, strings and tape nodes per second of a benchmark that handles the
+/// document once per iteration.
+inline void report_throughput(benchmark::State &state, const DocumentCounts &counts) {
+	state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(counts.bytes));
+	state.counters["tokens_per_second"] =
+		benchmark::Counter{static_cast<double>(counts.tokens), benchmark::Counter::kIsIterationInvariantRate};
+	state.counters["strings_per_second"] =
+		benchmark::Counter{static_cast<double>(counts.strings), benchmark::Counter::kIsIterationInvariantRate};
+	state.counters["tape_nodes_per_second"] =
+		benchmark::Counter{static_cast<double>(counts.tape_nodes), benchmark::Counter::kIsIterationInvariantRate};
+}
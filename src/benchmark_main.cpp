@@ -4,6 +4,7 @@
 
 constexpr auto JSON_PATH = "../data/processed/";
 
+extern void add_fpga_benchmark_context();
 extern void register_fpga_benchmarks_for(const std::string &dirname, const std::string &filename);
 extern void register_simdjson_benchmarks_for(const std::string &dirname, const std::string &filename);
 
@@ -37,6 +38,7 @@ int main(int argc, char **argv) {
 		register_fpga_benchmarks_for(JSON_PATH, filename);
 		register_simdjson_benchmarks_for(JSON_PATH, filename);
 	}
+	add_fpga_benchmark_context();
 	::benchmark::Initialize(&argc, argv);
 	if (::benchmark::ReportUnrecognizedArguments(argc, argv))
 		return 1;
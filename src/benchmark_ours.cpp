@@ -1,10 +1,15 @@
 #include <benchmark/benchmark.h>
 
+#include "benchmark_counters.hpp"
 #include "exception_handler.hpp"
 #include "json_parser.hpp"
+#include "mapped_file.hpp"
+#include "stage_timings.hpp"
 #include "taped_json.hpp"
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <thread>
 
 static sycl::queue setup_queue() {
 #if FPGA_SIMULATOR
@@ -18,64 +23,260 @@ static sycl::queue setup_queue() {
 	return q;
 }
 
+/// Map a file and read all of its pages, so that the timed loop of a benchmark never waits for the disk.
+static MappedFile map_input(const std::string &filename) { return MappedFile{filename, MapOptions{true}}; }
+
+/// Parse a file once more, outside of the timed loop, to count what the benchmark processed per iteration.
+static DocumentCounts count_document(JsonParser &parser, const std::string &filename) {
+	const auto input = map_input(filename);
+	const auto json = parser.parse(input);
+	return {input.size(), json.node_count() - 1, json.string_count(), json.node_count()};
+}
+
+/// Report the average time per iteration spent in every stage of the parse as counters, in seconds.
+static void report_stage_timings(benchmark::State &state, const StageTimings &timings) {
+	const auto report = [&](const std::string &name, const StageTimings::Duration duration) {
+		state.counters[name] = benchmark::Counter{std::chrono::duration<double>{duration}.count(),
+												  benchmark::Counter::kAvgIterations};
+	};
+	report("producer", timings.producer);
+	report("utf8_validator", timings.utf8_validator);
+	report("tokenizer", timings.tokenizer);
+	report("string_filter", timings.string_filter);
+	report("number_parser", timings.number_parser);
+	report("tape_builder", timings.tape_builder);
+	report("device", timings.device);
+	report("input_copy", timings.input_copy);
+	report("collect", timings.collect);
+	report("finish", timings.finish);
+}
+
 static void MAX_DEPTH_FPGA(benchmark::State &state, const std::string &filename) {
 	// Perform setup here
-	auto q = setup_queue();
-	std::ifstream file(filename);
-	const auto input = std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	auto parser = JsonParser{setup_queue()};
+	const auto input = map_input(filename);
 
 	for (auto _ : state) {
-		const auto json = parse(q, input);
+		const auto json = parser.parse(input);
 		auto max_depth = json.max_depth();
 		(void)max_depth;
 		//		std::cout << max_depth << std::endl;
 	}
+	report_throughput(state, count_document(parser, filename));
 }
 
 static void ONLY_PARSE_FPGA(benchmark::State &state, const std::string &filename) {
 	// Perform setup here
+	auto parser = JsonParser{setup_queue()};
+	const auto input = map_input(filename);
+
+	auto timings = StageTimings{};
+	auto total_timings = StageTimings{};
+	for (auto _ : state) {
+		const auto json = parser.parse(input, &timings);
+		(void)json;
+		total_timings += timings;
+	}
+	report_stage_timings(state, total_timings);
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void THREADED_PARSE_FPGA(benchmark::State &state, const std::string &filename) {
+	auto parser = JsonParser{setup_queue()};
+	parser.set_host_thread_count(std::thread::hardware_concurrency());
+	const auto input = map_input(filename);
+
+	for (auto _ : state) {
+		const auto json = parser.parse(input);
+		(void)json;
+	}
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void COLD_PARSE_FPGA(benchmark::State &state, const std::string &filename) {
+	auto q = setup_queue();
+	const auto input = map_input(filename);
+
+	// Every iteration pays for allocating the buffers of a new parser.
+	for (auto _ : state) {
+		auto parser = JsonParser{q};
+		const auto json = parser.parse(input);
+		(void)json;
+	}
+	auto parser = JsonParser{q};
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void WARM_PARSE_FPGA(benchmark::State &state, const std::string &filename) {
+	auto parser = JsonParser{setup_queue()};
+	const auto input = map_input(filename);
+
+	// Allocate and run the pipeline once before timing, so only the steady state is measured.
+	parser.reserve(input.size());
+	(void)parser.parse(input);
+	for (auto _ : state) {
+		const auto json = parser.parse(input);
+		(void)json;
+	}
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void ONLY_PARSE_HOST(benchmark::State &state, const std::string &filename) {
+	// The same pipeline on the host, e.g. to compare against simdjson on a machine without an FPGA.
+	auto parser = JsonParser{setup_queue(), Backend::Host};
+	const auto input = map_input(filename);
+
+	parser.reserve(input.size());
+	for (auto _ : state) {
+		const auto json = parser.parse(input);
+		(void)json;
+	}
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void SETUP_PHASE_FPGA(benchmark::State &state, const std::string &filename) {
 	auto q = setup_queue();
-	std::ifstream file(filename);
-	const auto input = std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	const auto input_size = static_cast<size_t>(file.tellg());
+
+	for (auto _ : state) {
+		const auto start_time = std::chrono::steady_clock::now();
+		auto parser = JsonParser{q};
+		parser.reserve(input_size);
+		state.SetIterationTime(std::chrono::duration<double>{std::chrono::steady_clock::now() - start_time}.count());
+	}
+}
+
+/**
+ * Time a single phase of warm parses, i.e. one of the durations of StageTimings. Registered with UseManualTime.
+ * @param phase Duration of the phase to time.
+ */
+static void PARSE_PHASE_FPGA(benchmark::State &state, const std::string &filename,
+							 const StageTimings::Duration StageTimings::*phase) {
+	auto parser = JsonParser{setup_queue()};
+	const auto input = map_input(filename);
+
+	parser.reserve(input.size());
+	(void)parser.parse(input);
+	auto timings = StageTimings{};
+	for (auto _ : state) {
+		const auto json = parser.parse(input, &timings);
+		(void)json;
+		state.SetIterationTime(std::chrono::duration<double>{timings.*phase}.count());
+	}
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void MAPPED_PARSE_FPGA(benchmark::State &state, const std::string &filename) {
+	auto parser = JsonParser{setup_queue()};
+
+	// Every iteration maps the file again, so loading it is timed as well: page faults instead of a read into a string.
+	for (auto _ : state) {
+		const auto input = MappedFile{filename};
+		const auto json = parser.parse(input);
+		(void)json;
+	}
+	report_throughput(state, count_document(parser, filename));
+}
+
+static void ONLY_PARSE_HOST_BUFFER_FPGA(benchmark::State &state, const std::string &filename) {
+	// Perform setup here
+	auto parser = JsonParser{setup_queue()};
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	const auto input_size = static_cast<size_t>(file.tellg());
+	auto *input = sycl::malloc_host<char>(input_size, parser.queue());
+	if (input == nullptr) {
+		state.SkipWithError("Could not allocate host memory for the input");
+		return;
+	}
+	file.seekg(0);
+	file.read(input, static_cast<std::streamsize>(input_size));
 
+	auto timings = StageTimings{};
+	auto total_timings = StageTimings{};
 	for (auto _ : state) {
-		const auto json = parse(q, input);
+		const auto json = parser.parse(input, input_size, &timings);
 		(void)json;
+		total_timings += timings;
 	}
+	report_stage_timings(state, total_timings);
+	report_throughput(state, count_document(parser, filename));
+
+	sycl::free(input, parser.queue());
+}
+
+static void ONLY_PARSE_STREAM_FPGA(benchmark::State &state, const std::string &filename) {
+	// Perform setup here
+	auto parser = JsonParser{setup_queue()};
+
+	for (auto _ : state) {
+		std::ifstream file(filename, std::ios::binary);
+		const auto json = parser.parse_stream(file);
+		(void)json;
+	}
+	report_throughput(state, count_document(parser, filename));
 }
 
 static void COUNT_STRING_LENGTHS_FPGA(benchmark::State &state, const std::string &filename) {
 	// Perform setup here
-	auto q = setup_queue();
-	std::ifstream file(filename);
-	const auto input = std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	auto parser = JsonParser{setup_queue()};
+	const auto input = map_input(filename);
 
 	for (auto _ : state) {
-		const auto json = parse(q, input);
+		const auto json = parser.parse(input);
 		auto count = json.count_string_lengths();
 		(void)count;
 		//		std::cout << count << std::endl;
 	}
+	report_throughput(state, count_document(parser, filename));
 }
 
 static void COUNT_STRING_CHARS_FPGA(benchmark::State &state, const std::string &filename) {
 	// Perform setup here
-	auto q = setup_queue();
-	std::ifstream file(filename);
-	const auto input = std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	auto parser = JsonParser{setup_queue()};
+	const auto input = map_input(filename);
 
 	for (auto _ : state) {
-		const auto json = parse(q, input);
+		const auto json = parser.parse(input);
 		auto count = json.count_string_chars();
 		(void)count;
 		//		std::cout << count << std::endl;
 	}
+	report_throughput(state, count_document(parser, filename));
+}
+
+void add_fpga_benchmark_context() {
+	// Every pipeline configuration is a build of its own, so the results of a sweep are told apart by their context.
+	benchmark::AddCustomContext("fpga_line_size", std::to_string(CACHE_LINE_SIZE));
+	benchmark::AddCustomContext("fpga_pipe_depth", std::to_string(PIPELINE_DEPTH));
+	benchmark::AddCustomContext("fpga_lanes", std::to_string(LANE_COUNT));
 }
 
 void register_fpga_benchmarks_for(const std::string &dirname, const std::string &filename) {
 	// Register the function as a benchmark
 	benchmark::RegisterBenchmark("fpga::parse::" + filename, ONLY_PARSE_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("fpga::parse_threads::" + filename, THREADED_PARSE_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("fpga::parse_cold::" + filename, COLD_PARSE_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("fpga::parse_warm::" + filename, WARM_PARSE_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("fpga::phase::setup::" + filename, SETUP_PHASE_FPGA, dirname + filename)
+		->UseManualTime();
+	benchmark::RegisterBenchmark("fpga::phase::input_copy::" + filename, PARSE_PHASE_FPGA, dirname + filename,
+								 &StageTimings::input_copy)
+		->UseManualTime();
+	benchmark::RegisterBenchmark("fpga::phase::device::" + filename, PARSE_PHASE_FPGA, dirname + filename,
+								 &StageTimings::device)
+		->UseManualTime();
+	benchmark::RegisterBenchmark("fpga::phase::collect::" + filename, PARSE_PHASE_FPGA, dirname + filename,
+								 &StageTimings::collect)
+		->UseManualTime();
+	benchmark::RegisterBenchmark("fpga::phase::finish::" + filename, PARSE_PHASE_FPGA, dirname + filename,
+								 &StageTimings::finish)
+		->UseManualTime();
+	benchmark::RegisterBenchmark("fpga::parse_mapped::" + filename, MAPPED_PARSE_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("fpga::parse_host_buffer::" + filename, ONLY_PARSE_HOST_BUFFER_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("fpga::parse_stream::" + filename, ONLY_PARSE_STREAM_FPGA, dirname + filename);
 	benchmark::RegisterBenchmark("fpga::max_depth::" + filename, MAX_DEPTH_FPGA, dirname + filename);
 	benchmark::RegisterBenchmark("fpga::string_lengths::" + filename, COUNT_STRING_LENGTHS_FPGA, dirname + filename);
 	benchmark::RegisterBenchmark("fpga::string_chars::" + filename, COUNT_STRING_CHARS_FPGA, dirname + filename);
+	benchmark::RegisterBenchmark("host::parse::" + filename, ONLY_PARSE_HOST, dirname + filename);
 }
\ No newline at end of file
@@ -1,9 +1,47 @@
+#include "benchmark_counters.hpp"
 #include "simdjson/simdjson.h"
 #include <benchmark/benchmark.h>
+#include <chrono>
 
 using namespace simdjson;
 using namespace simdjson::ondemand;
 
+static void count_element(dom::element element, DocumentCounts &counts) {
+	switch (element.type()) {
+	case dom::element_type::ARRAY:
+		counts.tokens += 2;
+		for (auto child : dom::array(element)) {
+			count_element(child, counts);
+		}
+		break;
+	case dom::element_type::OBJECT:
+		counts.tokens += 2;
+		for (auto field : dom::object(element)) {
+			++counts.tokens;
+			++counts.strings;
+			count_element(field.value, counts);
+		}
+		break;
+	case dom::element_type::STRING:
+		++counts.tokens;
+		++counts.strings;
+		break;
+	default:
+		++counts.tokens;
+		break;
+	}
+}
+
+/// Count what a benchmark processes per iteration, independently of the ondemand API the benchmarks use.
+static DocumentCounts count_document(const std::string &filename) {
+	const auto json = padded_string::load(filename).value();
+	auto parser = dom::parser{};
+	auto counts = DocumentCounts{json.size(), 0, 0, 0};
+	count_element(parser.parse(json).value(), counts);
+	counts.tape_nodes = counts.tokens + 1;
+	return counts;
+}
+
 static size_t value_depth(simdjson_result<ondemand::value> value);
 static size_t array_depth(simdjson_result<ondemand::array> array);
 static size_t object_depth(simdjson_result<ondemand::object> object);
@@ -46,6 +84,7 @@ static void MAX_DEPTH_SIMDJSON(benchmark::State &state, const std::string &filen
 		(void)depth;
 		//		std::cout << depth << std::endl;
 	}
+	report_throughput(state, count_document(filename));
 }
 
 static void ONLY_PARSE_SIMDJSON(benchmark::State &state, const std::string &filename) {
@@ -56,6 +95,36 @@ static void ONLY_PARSE_SIMDJSON(benchmark::State &state, const std::string &file
 		auto value = document.get_value();
 		(void)value;
 	}
+	report_throughput(state, count_document(filename));
+}
+
+static void WARM_PARSE_SIMDJSON(benchmark::State &state, const std::string &filename) {
+	const auto json = simdjson::padded_string::load(filename);
+	auto parser = simdjson::ondemand::parser{};
+
+	// Allocate and parse once before timing, so only the steady state is measured.
+	(void)parser.iterate(json).get_value();
+	for (auto _ : state) {
+		auto document = parser.iterate(json);
+		auto value = document.get_value();
+		(void)value;
+	}
+	report_throughput(state, count_document(filename));
+}
+
+static void SETUP_PHASE_SIMDJSON(benchmark::State &state, const std::string &filename) {
+	const auto input_size = simdjson::padded_string::load(filename).value().size();
+
+	for (auto _ : state) {
+		const auto start_time = std::chrono::steady_clock::now();
+		auto parser = simdjson::ondemand::parser{};
+		const auto error = parser.allocate(input_size);
+		state.SetIterationTime(std::chrono::duration<double>{std::chrono::steady_clock::now() - start_time}.count());
+		if (error) {
+			state.SkipWithError(error_message(error));
+			break;
+		}
+	}
 }
 
 static size_t count_string_lengths(simdjson_result<ondemand::value> value);
@@ -102,6 +171,7 @@ static void COUNT_STRING_LENGTHS_SIMDJSON(benchmark::State &state, const std::st
 		(void)count;
 		//		std::cout << count << std::endl;
 	}
+	report_throughput(state, count_document(filename));
 }
 
 static void count_string_chars(simdjson_result<ondemand::value> value, uint64_t &count);
@@ -155,11 +225,15 @@ static void COUNT_STRING_CHARS_SIMDJSON(benchmark::State &state, const std::stri
 		(void)count;
 		// std::cout << count << std::endl;
 	}
+	report_throughput(state, count_document(filename));
 }
 
 void register_simdjson_benchmarks_for(const std::string &dirname, const std::string &filename) {
 	// Register the function as a benchmark
 	benchmark::RegisterBenchmark("simdjson::parse::" + filename, ONLY_PARSE_SIMDJSON, dirname + filename);
+	benchmark::RegisterBenchmark("simdjson::parse_warm::" + filename, WARM_PARSE_SIMDJSON, dirname + filename);
+	benchmark::RegisterBenchmark("simdjson::phase::setup::" + filename, SETUP_PHASE_SIMDJSON, dirname + filename)
+		->UseManualTime();
 	benchmark::RegisterBenchmark("simdjson::max_depth::" + filename, MAX_DEPTH_SIMDJSON, dirname + filename);
 	benchmark::RegisterBenchmark("simdjson::string_lengths::" + filename, COUNT_STRING_LENGTHS_SIMDJSON,
 								 dirname + filename);
@@ -2,17 +2,76 @@
 
 #include <array>
 #include <bitset>
+#include <cstdint>
+
+#include "constexpr_math.hpp"
+#include "unrolled_loop.hpp"
+
+// Configuration, every combination is a separate design. Set with -D<option>=<value> to sweep them per board.
+#ifndef PIPELINE_LINE_SIZE
+/// Bytes every stage of the pipeline handles per lane and iteration, a power of two from 4 to 128.
+#define PIPELINE_LINE_SIZE 64
+#endif
+#ifndef PIPELINE_PIPE_DEPTH
+/// Lines the pipe between two stages buffers, so a stalling stage does not stall the stage before it right away.
+#define PIPELINE_PIPE_DEPTH 1
+#endif
 
 // Constants
-constexpr auto CACHE_LINE_SIZE = size_t{64};
-constexpr auto PIPELINE_DEPTH = size_t{1};
+constexpr auto CACHE_LINE_SIZE = size_t{PIPELINE_LINE_SIZE};
+constexpr auto PIPELINE_DEPTH = size_t{PIPELINE_PIPE_DEPTH};
+static_assert(CACHE_LINE_SIZE >= 4 && CACHE_LINE_SIZE <= 128 && fpga_tools::IsPow2(CACHE_LINE_SIZE),
+			  "The line size must be a power of two from 4 to 128.");
+#ifndef PIPELINE_LANES
+/// Consecutive cache lines every stage of the pipeline accepts per iteration, each over a pipe of its own. Set with
+/// -DPIPELINE_LANES=<lanes> to match the width of the memory interface of the board.
+#define PIPELINE_LANES 1
+#endif
+constexpr auto LANE_COUNT = size_t{PIPELINE_LANES};
+#ifndef PIPELINE_NUMBER_CONVERTERS
+/// Numbers the number parser converts to their values per lane and iteration. Lines that complete more numbers take an
+/// iteration for every this many.
+#define PIPELINE_NUMBER_CONVERTERS 4
+#endif
+constexpr auto NUMBER_CONVERTER_COUNT = size_t{PIPELINE_NUMBER_CONVERTERS};
+/// Every completed number needs at least one digit and one terminating byte, plus one number flushed at the end.
+constexpr auto MAX_NUMBERS_PER_LINE = CACHE_LINE_SIZE / 2 + 1;
+/// Strings are separated by at least their closing quote, so at most every second byte of a line starts one. One more
+/// part ends at the first byte, for a string from the previous line that decodes to a character only once it closes,
+/// like the replacement character of a trailing unpaired surrogate escape.
+constexpr auto MAX_STRINGS_PER_LINE = CACHE_LINE_SIZE / 2 + 1;
+/// An unpaired high surrogate followed by a three byte \uXXXX escape decodes to six bytes at once.
+constexpr auto MAX_DECODED_BYTES = size_t{6};
+/// Decoded strings never grow, except for an escape carried over from the previous line that completes in the first
+/// byte of a line.
+constexpr auto STRING_LINE_SIZE = CACHE_LINE_SIZE - 1 + MAX_DECODED_BYTES;
+/// Bits to store the length of a string within a single line, which is at most STRING_LINE_SIZE.
+constexpr auto STRING_LENGTH_BITS = fpga_tools::BitsForMaxValue<STRING_LINE_SIZE>();
+constexpr auto STRING_LENGTHS_PER_WORD = 64 / STRING_LENGTH_BITS;
+constexpr auto STRING_LENGTH_WORDS = (MAX_STRINGS_PER_LINE + STRING_LENGTHS_PER_WORD - 1) / STRING_LENGTHS_PER_WORD;
+static_assert(STRING_LENGTH_BITS <= 8, "String lengths must fit into the uint8_t they are decoded to.");
+/// JSON text never contains a NUL byte, so it doubles as "do not split the input into documents".
+constexpr auto NO_DOCUMENT_SEPARATOR = '\0';
 
 // Types
 using CacheLine = std::array<char, CACHE_LINE_SIZE>;
+/// Decoded string characters of a cache line.
+using StringLine = std::array<char, STRING_LINE_SIZE>;
 struct Bitmaps;
 
 using Bitmap = std::bitset<CACHE_LINE_SIZE>;
 
+/// Index of the first set bit, or CACHE_LINE_SIZE if there is none.
+size_t first_set_index(const Bitmap &bitmap) {
+	auto index = CACHE_LINE_SIZE;
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto reverse_index) {
+		if (bitmap[CACHE_LINE_SIZE - 1 - reverse_index]) {
+			index = CACHE_LINE_SIZE - 1 - reverse_index;
+		}
+	});
+	return index;
+}
+
 /// Possible overflow types.
 enum OverflowState {
 	/// No overflow.
@@ -21,6 +80,8 @@ enum OverflowState {
 	String,
 	/// An unfinished string with a backslash at the end.
 	StringWithBackslash,
+	/// An unfinished number at the end of this line.
+	Number,
 	/// Number of items in this enum.
 	COUNT,
 };
@@ -34,9 +95,71 @@ enum Token : uint8_t {
 	ArrayEndToken,
 	StringToken,
 	FloatToken,
-	IntegerToken
+	IntegerToken,
+	/// A number as emitted by the tokenizer, resolved to IntegerToken or FloatToken once it is parsed.
+	NumberToken,
+	TrueToken,
+	FalseToken,
+	NullToken,
+	/// Ends a document when parsing multiple documents at once.
+	DocumentEndToken,
+	/// Separators, only used to validate the structure and never stored on the tape.
+	ColonToken,
+	CommaToken
+};
+
+/// Errors detected while parsing, see ParseStatus.
+enum class ErrorCode : uint8_t {
+	None = 0,
+	/// A byte that is not part of well-formed UTF-8.
+	InvalidUtf8,
+	/// A byte outside of strings that cannot occur in JSON.
+	UnexpectedCharacter,
+	/// A backslash followed by a character that does not form an escape, or a \u not followed by four hex digits.
+	InvalidEscape,
+	/// A control character inside of a string that is not escaped.
+	UnescapedControlCharacter,
+	/// The input ends inside of a string.
+	UnclosedString,
+	/// A number that does not follow the JSON number grammar.
+	InvalidNumber,
+	/// A token that cannot occur at its position, e.g. a missing or superfluous comma or colon.
+	UnexpectedToken,
+	/// A closing bracket or brace that does not match the open scope.
+	MismatchedBracket,
+	/// The input ends inside of an object or array.
+	UnclosedScope,
+	/// A document without any value.
+	EmptyDocument,
+	/// Objects and arrays nested deeper than the tape builder supports.
+	DepthExceeded,
+	/// An object or array whose end is further from the start of its document than a begin node can store.
+	ScopeTooLarge,
+};
+
+/// The first error found by a stage of the pipeline, written by the device to memory shared with the host.
+struct ParseStatus {
+	ErrorCode code;
+	/// Byte offset of the error in the input.
+	size_t offset;
+
+	/// Record an error unless there already is an earlier one. Reporting ErrorCode::None does nothing.
+	void report(const ErrorCode error_code, const size_t error_offset) {
+		if (code == ErrorCode::None && error_code != ErrorCode::None) {
+			code = error_code;
+			offset = error_offset;
+		}
+	}
 };
 
+// Slots of the statuses the stages of the pipeline report to, in the order they see the input.
+constexpr auto UTF8_VALIDATOR_STATUS = size_t{0};
+constexpr auto TOKENIZER_STATUS = size_t{1};
+constexpr auto STRING_FILTER_STATUS = size_t{2};
+constexpr auto NUMBER_PARSER_STATUS = size_t{3};
+constexpr auto TAPE_BUILDER_STATUS = size_t{4};
+constexpr auto STATUS_COUNT = size_t{5};
+
 template <typename OS> constexpr OS &print(OS &os, OverflowState state) {
 	switch (state) {
 	case OverflowState::None:
@@ -48,6 +171,9 @@ template <typename OS> constexpr OS &print(OS &os, OverflowState state) {
 	case OverflowState::StringWithBackslash:
 		os << "StringWithBackslash";
 		break;
+	case OverflowState::Number:
+		os << "Number";
+		break;
 	default:
 		os << "unknown";
 		break;
@@ -59,6 +185,7 @@ struct Bitmaps {
 	// CacheLine input;
 	Bitmap is_string;
 	Bitmap is_escaped;
+	Bitmap is_number;
 	OverflowState overflow_state;
 };
 
@@ -66,10 +193,53 @@ struct TokenizedCacheLine {
 	CacheLine line;
 	Bitmaps bitmaps;
 	CacheLine tokens;
+	/// Position of every token in the line, used to locate errors.
+	Bitmap token_starts;
+};
+
+/// A number parsed on the device, interpreted according to the matching bit in NumberCacheLine::is_float.
+union NumberValue {
+	int64_t integer;
+	double floating_point;
+};
+
+/// All numbers that end within a single cache line, in input order.
+struct NumberCacheLine {
+	std::array<NumberValue, MAX_NUMBERS_PER_LINE> values;
+	std::bitset<MAX_NUMBERS_PER_LINE> is_float;
+	/// Floats whose rounding depends on more digits than the device keeps. Their value holds the offset of their first
+	/// character in the input instead, from where the host converts them.
+	std::bitset<MAX_NUMBERS_PER_LINE> needs_host_conversion;
+	uint8_t count;
+};
+
+/// Describes how the filtered characters of a cache line split into strings.
+struct StringMetadata {
+	/// Lengths of the strings in input order, packed STRING_LENGTHS_PER_WORD to a word.
+	std::array<uint64_t, STRING_LENGTH_WORDS> packed_lengths;
+	/// Number of strings or string parts in this line.
+	uint8_t count;
+	/// Whether the first string continues the last string of the previous line.
+	bool continues_string;
+
+	void push_length(const uint8_t length) {
+		const auto word = count / STRING_LENGTHS_PER_WORD;
+		const auto shift = (count % STRING_LENGTHS_PER_WORD) * STRING_LENGTH_BITS;
+		packed_lengths[word] |= static_cast<uint64_t>(length) << shift;
+		++count;
+	}
+
+	uint8_t length(const size_t index) const {
+		const auto word = index / STRING_LENGTHS_PER_WORD;
+		const auto shift = (index % STRING_LENGTHS_PER_WORD) * STRING_LENGTH_BITS;
+		return (packed_lengths[word] >> shift) & ((1 << STRING_LENGTH_BITS) - 1);
+	}
 };
 
 struct OutputCacheLine {
-	CacheLine line;
-	CacheLine string_lengths;
+	StringLine line;
+	StringMetadata strings;
 	CacheLine tokens;
+	Bitmap token_starts;
+	NumberCacheLine numbers;
 };
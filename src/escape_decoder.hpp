@@ -0,0 +1,172 @@
+#pragma once
+
+#include "definitions.hpp"
+#include "unrolled_loop.hpp"
+
+/// Hex digits following a "\u".
+constexpr auto UNICODE_ESCAPE_DIGITS = uint8_t{4};
+/// U+FFFD, decoded in place of a surrogate that is not part of a pair.
+constexpr auto REPLACEMENT_CHARACTER = uint32_t{0xFFFD};
+constexpr auto HIGH_SURROGATE_BEGIN = uint16_t{0xD800};
+constexpr auto LOW_SURROGATE_BEGIN = uint16_t{0xDC00};
+constexpr auto LOW_SURROGATE_END = uint16_t{0xE000};
+
+/// Partially decoded escape sequence, carried across cache lines.
+struct EscapeState {
+	/// Hex digits of the current \uXXXX escape still to read, zero outside of one.
+	uint8_t digits_remaining;
+	/// UTF-16 code unit accumulated from the hex digits read so far.
+	uint16_t code_unit;
+	/// High surrogate waiting for its low surrogate, zero if there is none.
+	uint16_t high_surrogate;
+};
+
+/// Bytes decoded from a single input character.
+struct DecodedChars {
+	std::array<char, MAX_DECODED_BYTES> chars;
+	uint8_t count;
+	/// Set if the input character is not allowed at its position.
+	ErrorCode error;
+
+	void push(const char c) { chars[count++] = c; }
+
+	void push_utf8(const uint32_t code_point) {
+		if (code_point < 0x80) {
+			push(static_cast<char>(code_point));
+		} else if (code_point < 0x800) {
+			push(static_cast<char>(0xC0 | (code_point >> 6)));
+			push(static_cast<char>(0x80 | (code_point & 0x3F)));
+		} else if (code_point < 0x10000) {
+			push(static_cast<char>(0xE0 | (code_point >> 12)));
+			push(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+			push(static_cast<char>(0x80 | (code_point & 0x3F)));
+		} else {
+			push(static_cast<char>(0xF0 | (code_point >> 18)));
+			push(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+			push(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+			push(static_cast<char>(0x80 | (code_point & 0x3F)));
+		}
+	}
+};
+
+/// Whether a character is a hex digit.
+bool is_hex_digit(const char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
+/// Value of a hex digit, invalid digits count as zero.
+uint8_t hex_value(const char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return 0;
+}
+
+/// Decode a high surrogate that turned out to be unpaired as the replacement character.
+void flush_high_surrogate(EscapeState &state, DecodedChars &decoded) {
+	if (state.high_surrogate != 0) {
+		decoded.push_utf8(REPLACEMENT_CHARACTER);
+		state.high_surrogate = 0;
+	}
+}
+
+/// Decode a complete UTF-16 code unit from a \uXXXX escape, joining surrogate pairs.
+void decode_code_unit(EscapeState &state, DecodedChars &decoded) {
+	const auto code_unit = state.code_unit;
+	if (code_unit >= HIGH_SURROGATE_BEGIN && code_unit < LOW_SURROGATE_BEGIN) {
+		flush_high_surrogate(state, decoded);
+		state.high_surrogate = code_unit;
+	} else if (code_unit >= LOW_SURROGATE_BEGIN && code_unit < LOW_SURROGATE_END) {
+		if (state.high_surrogate != 0) {
+			const auto high_bits = static_cast<uint32_t>(state.high_surrogate - HIGH_SURROGATE_BEGIN);
+			const auto low_bits = static_cast<uint32_t>(code_unit - LOW_SURROGATE_BEGIN);
+			const auto code_point = 0x10000 + ((high_bits << 10) | low_bits);
+			decoded.push_utf8(code_point);
+			state.high_surrogate = 0;
+		} else {
+			decoded.push_utf8(REPLACEMENT_CHARACTER);
+		}
+	} else {
+		flush_high_surrogate(state, decoded);
+		decoded.push_utf8(code_unit);
+	}
+}
+
+/**
+ * Decode a single character inside a string. Quotes and the backslashes starting an escape decode to nothing, the
+ * escaped character to its value. \uXXXX escapes are decoded to UTF-8 once their last digit is read.
+ * @param state Escape sequence in progress, updated.
+ * @param c Character inside the string.
+ * @param is_escaped Whether the character is preceded by an unescaped backslash.
+ * @return The decoded bytes, at most MAX_DECODED_BYTES, and an error if the character is not allowed here.
+ */
+DecodedChars decode_string_char(EscapeState &state, const char c, const bool is_escaped) {
+	auto decoded = DecodedChars{};
+
+	if (state.digits_remaining > 0) {
+		if (!is_hex_digit(c)) {
+			decoded.error = ErrorCode::InvalidEscape;
+		}
+		state.code_unit = (state.code_unit << 4) | hex_value(c);
+		if (--state.digits_remaining == 0) {
+			decode_code_unit(state, decoded);
+		}
+	} else if (is_escaped) {
+		if (c == 'u') {
+			state.digits_remaining = UNICODE_ESCAPE_DIGITS;
+			state.code_unit = 0;
+		} else {
+			flush_high_surrogate(state, decoded);
+			switch (c) {
+			case '\"':
+			case '\\':
+			case '/':
+				decoded.push(c);
+				break;
+			case 'b':
+				decoded.push('\b');
+				break;
+			case 'f':
+				decoded.push('\f');
+				break;
+			case 'n':
+				decoded.push('\n');
+				break;
+			case 'r':
+				decoded.push('\r');
+				break;
+			case 't':
+				decoded.push('\t');
+				break;
+			default:
+				decoded.error = ErrorCode::InvalidEscape;
+				break;
+			}
+		}
+	} else if (c != '\"' && c != '\\') {
+		if (static_cast<uint8_t>(c) < 0x20) {
+			decoded.error = ErrorCode::UnescapedControlCharacter;
+		}
+		flush_high_surrogate(state, decoded);
+		decoded.push(c);
+	}
+
+	return decoded;
+}
+
+/**
+ * Finish the escape sequence in progress when its string ends.
+ * @return The replacement character for a trailing unpaired high surrogate, nothing otherwise. An error if the string
+ * ends within a \uXXXX escape.
+ */
+DecodedChars finish_string(EscapeState &state) {
+	auto decoded = DecodedChars{};
+	flush_high_surrogate(state, decoded);
+	if (state.digits_remaining > 0) {
+		decoded.error = ErrorCode::InvalidEscape;
+	}
+	state.digits_remaining = 0;
+	return decoded;
+}
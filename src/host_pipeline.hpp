@@ -0,0 +1,390 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "definitions.hpp"
+#include "number_parser.hpp"
+#include "string_filter.hpp"
+#include "tape_builder.hpp"
+#include "tokenizer.hpp"
+#include "utf8_validator.hpp"
+
+// The vector paths are only compiled for the host, the device never runs the host pipeline.
+#if defined(__x86_64__) && !defined(__SYCL_DEVICE_ONLY__)
+#define HOST_PIPELINE_X86 1
+#include <immintrin.h>
+#endif
+
+/// Vector instructions the host pipeline classifies the bytes of a line with.
+enum class SimdLevel : uint8_t {
+	/// One byte at a time, on any host.
+	Scalar,
+	/// 32 bytes at a time.
+	Avx2,
+	/// 64 bytes at a time, and strings are compacted with a single instruction (AVX-512 BW and VBMI2).
+	Avx512,
+};
+
+/// Widest SimdLevel the host supports that fits whole lines.
+SimdLevel detect_simd_level() {
+#ifdef HOST_PIPELINE_X86
+	if (CACHE_LINE_SIZE % 64 == 0 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi2")) {
+		return SimdLevel::Avx512;
+	}
+	if (CACHE_LINE_SIZE % 32 == 0 && __builtin_cpu_supports("avx2")) {
+		return SimdLevel::Avx2;
+	}
+#endif
+	return SimdLevel::Scalar;
+}
+
+/// Classes of the bytes of a line the tokenizer needs, and those the host pipeline uses to skip work.
+struct HostByteClasses {
+	ByteClasses tokenizer;
+	/// Bytes from 0x80 on, without which a line is valid UTF-8 by itself.
+	Bitmap non_ascii;
+	/// Bytes below 0x20, which must be escaped inside of strings.
+	Bitmap control;
+};
+
+/// Index of the lowest set bit, which must exist.
+size_t lowest_set_index(const Bitmap &bitmap) {
+	if constexpr (CACHE_LINE_SIZE <= 64) {
+		return static_cast<size_t>(__builtin_ctzll(bitmap.to_ullong()));
+	} else {
+		const auto low_word = (bitmap & Bitmap{~uint64_t{0}}).to_ullong();
+		return low_word != 0 ? static_cast<size_t>(__builtin_ctzll(low_word))
+							 : 64 + static_cast<size_t>(__builtin_ctzll((bitmap >> 64).to_ullong()));
+	}
+}
+
+/// Set the bits of a bitmap that belong to a chunk of a line, from the mask of the chunk.
+void set_chunk(Bitmap &bitmap, const uint64_t mask, const size_t offset) { bitmap |= Bitmap{mask} << offset; }
+
+/// Classify the bytes of a line one at a time.
+HostByteClasses classify_host_bytes_scalar(const CacheLine &line, const char document_separator) {
+	auto classes = HostByteClasses{classify_bytes(line, document_separator)};
+	for (auto byte_index = size_t{0}; byte_index < CACHE_LINE_SIZE; ++byte_index) {
+		const auto byte = static_cast<uint8_t>(line[byte_index]);
+		classes.non_ascii[byte_index] = byte >= 0x80;
+		classes.control[byte_index] = byte < 0x20;
+	}
+	return classes;
+}
+
+#ifdef HOST_PIPELINE_X86
+__attribute__((target("avx2"))) uint64_t equal_mask_avx2(const __m256i bytes, const char c) {
+	return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c))));
+}
+
+/// Mask of the bytes from `low` to `high`, both inclusive and compared as unsigned.
+__attribute__((target("avx2"))) uint64_t range_mask_avx2(const __m256i bytes, const char low, const char high) {
+	const auto above_low = _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, _mm256_set1_epi8(low)), bytes);
+	const auto below_high = _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, _mm256_set1_epi8(high)), bytes);
+	return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(above_low, below_high)));
+}
+
+/// Classify the bytes of a line 32 at a time.
+__attribute__((target("avx2"))) HostByteClasses classify_host_bytes_avx2(const CacheLine &line,
+																		 const char document_separator) {
+	auto classes = HostByteClasses{};
+	auto &tokenizer = classes.tokenizer;
+	for (auto offset = size_t{0}; offset < CACHE_LINE_SIZE; offset += 32) {
+		const auto bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(line.data() + offset));
+
+		const auto quotes = equal_mask_avx2(bytes, '"');
+		const auto structurals = equal_mask_avx2(bytes, '{') | equal_mask_avx2(bytes, '}') |
+								 equal_mask_avx2(bytes, '[') | equal_mask_avx2(bytes, ']');
+		const auto separators = equal_mask_avx2(bytes, ':') | equal_mask_avx2(bytes, ',');
+		const auto whitespace = equal_mask_avx2(bytes, ' ') | equal_mask_avx2(bytes, '\t') |
+								equal_mask_avx2(bytes, '\n') | equal_mask_avx2(bytes, '\r');
+		const auto number_firsts = equal_mask_avx2(bytes, '-') | range_mask_avx2(bytes, '0', '9');
+		const auto number_chars = number_firsts | equal_mask_avx2(bytes, '+') | equal_mask_avx2(bytes, '.') |
+								  equal_mask_avx2(bytes, 'e') | equal_mask_avx2(bytes, 'E');
+		const auto literal_firsts = equal_mask_avx2(bytes, 't') | equal_mask_avx2(bytes, 'f') |
+									equal_mask_avx2(bytes, 'n');
+		const auto letters = range_mask_avx2(bytes, 'a', 'z') | range_mask_avx2(bytes, 'A', 'Z');
+
+		set_chunk(tokenizer.quotes, quotes, offset);
+		set_chunk(tokenizer.backslashes, equal_mask_avx2(bytes, '\\'), offset);
+		set_chunk(tokenizer.structurals, structurals, offset);
+		set_chunk(tokenizer.separators, separators, offset);
+		set_chunk(tokenizer.allowed, whitespace | structurals | separators | quotes | number_chars, offset);
+		set_chunk(tokenizer.letters, letters, offset);
+		set_chunk(tokenizer.number_chars, number_chars, offset);
+		set_chunk(tokenizer.number_firsts, number_firsts, offset);
+		set_chunk(tokenizer.literal_firsts, literal_firsts, offset);
+		if (document_separator != NO_DOCUMENT_SEPARATOR) {
+			set_chunk(tokenizer.document_ends, equal_mask_avx2(bytes, document_separator), offset);
+		}
+		set_chunk(classes.non_ascii, static_cast<uint32_t>(_mm256_movemask_epi8(bytes)), offset);
+		set_chunk(classes.control, range_mask_avx2(bytes, '\0', '\x1f'), offset);
+	}
+	return classes;
+}
+
+__attribute__((target("avx512bw"))) uint64_t equal_mask_avx512(const __m512i bytes, const char c) {
+	return _mm512_cmpeq_epi8_mask(bytes, _mm512_set1_epi8(c));
+}
+
+/// Classify the bytes of a line 64 at a time.
+__attribute__((target("avx512bw"))) HostByteClasses classify_host_bytes_avx512(const CacheLine &line,
+																			   const char document_separator) {
+	auto classes = HostByteClasses{};
+	auto &tokenizer = classes.tokenizer;
+	for (auto offset = size_t{0}; offset < CACHE_LINE_SIZE; offset += 64) {
+		const auto bytes = _mm512_loadu_si512(line.data() + offset);
+
+		const auto quotes = equal_mask_avx512(bytes, '"');
+		const auto structurals = equal_mask_avx512(bytes, '{') | equal_mask_avx512(bytes, '}') |
+								 equal_mask_avx512(bytes, '[') | equal_mask_avx512(bytes, ']');
+		const auto separators = equal_mask_avx512(bytes, ':') | equal_mask_avx512(bytes, ',');
+		const auto whitespace = equal_mask_avx512(bytes, ' ') | equal_mask_avx512(bytes, '\t') |
+								equal_mask_avx512(bytes, '\n') | equal_mask_avx512(bytes, '\r');
+		const auto digits = _mm512_cmpge_epu8_mask(bytes, _mm512_set1_epi8('0')) &
+							_mm512_cmple_epu8_mask(bytes, _mm512_set1_epi8('9'));
+		const auto number_firsts = equal_mask_avx512(bytes, '-') | digits;
+		const auto number_chars = number_firsts | equal_mask_avx512(bytes, '+') | equal_mask_avx512(bytes, '.') |
+								  equal_mask_avx512(bytes, 'e') | equal_mask_avx512(bytes, 'E');
+		const auto literal_firsts = equal_mask_avx512(bytes, 't') | equal_mask_avx512(bytes, 'f') |
+									equal_mask_avx512(bytes, 'n');
+		const auto letters = (_mm512_cmpge_epu8_mask(bytes, _mm512_set1_epi8('a')) &
+							  _mm512_cmple_epu8_mask(bytes, _mm512_set1_epi8('z'))) |
+							 (_mm512_cmpge_epu8_mask(bytes, _mm512_set1_epi8('A')) &
+							  _mm512_cmple_epu8_mask(bytes, _mm512_set1_epi8('Z')));
+
+		set_chunk(tokenizer.quotes, quotes, offset);
+		set_chunk(tokenizer.backslashes, equal_mask_avx512(bytes, '\\'), offset);
+		set_chunk(tokenizer.structurals, structurals, offset);
+		set_chunk(tokenizer.separators, separators, offset);
+		set_chunk(tokenizer.allowed, whitespace | structurals | separators | quotes | number_chars, offset);
+		set_chunk(tokenizer.letters, letters, offset);
+		set_chunk(tokenizer.number_chars, number_chars, offset);
+		set_chunk(tokenizer.number_firsts, number_firsts, offset);
+		set_chunk(tokenizer.literal_firsts, literal_firsts, offset);
+		if (document_separator != NO_DOCUMENT_SEPARATOR) {
+			set_chunk(tokenizer.document_ends, equal_mask_avx512(bytes, document_separator), offset);
+		}
+		set_chunk(classes.non_ascii, _mm512_movepi8_mask(bytes), offset);
+		set_chunk(classes.control, _mm512_cmplt_epu8_mask(bytes, _mm512_set1_epi8(0x20)), offset);
+	}
+	return classes;
+}
+
+/// Compact the bytes of a line selected by a bitmap to the front of `chars`, 64 at a time.
+__attribute__((target("avx512bw,avx512vbmi2"))) size_t compress_chars_avx512(const CacheLine &line,
+																			 const Bitmap &selected,
+																			 StringLine &chars) {
+	auto count = size_t{0};
+	for (auto offset = size_t{0}; offset < CACHE_LINE_SIZE; offset += 64) {
+		const auto mask = ((selected >> offset) & Bitmap{~uint64_t{0}}).to_ullong();
+		const auto bytes = _mm512_loadu_si512(line.data() + offset);
+		// The bytes after the selected ones are zero, just like those a line is initialized with.
+		_mm512_storeu_si512(chars.data() + count, _mm512_maskz_compress_epi8(mask, bytes));
+		count += static_cast<size_t>(__builtin_popcountll(mask));
+	}
+	return count;
+}
+#endif
+
+/**
+ * Classify the bytes of a line with the given instructions, which the host must support.
+ * @param line Line to classify.
+ * @param document_separator Byte that separates documents, see compute_bitmaps().
+ * @param level Instructions to use.
+ */
+HostByteClasses classify_host_bytes(const CacheLine &line, const char document_separator, const SimdLevel level) {
+#ifdef HOST_PIPELINE_X86
+	if constexpr (CACHE_LINE_SIZE % 64 == 0) {
+		if (level == SimdLevel::Avx512) {
+			return classify_host_bytes_avx512(line, document_separator);
+		}
+	}
+	if constexpr (CACHE_LINE_SIZE % 32 == 0) {
+		if (level != SimdLevel::Scalar) {
+			return classify_host_bytes_avx2(line, document_separator);
+		}
+	}
+#endif
+	return classify_host_bytes_scalar(line, document_separator);
+}
+
+/**
+ * Compact the bytes of a line selected by a bitmap to the front of `chars`, in order.
+ * @return The number of selected bytes.
+ */
+size_t compress_chars(const CacheLine &line, const Bitmap &selected, StringLine &chars, const SimdLevel level) {
+#ifdef HOST_PIPELINE_X86
+	if constexpr (CACHE_LINE_SIZE % 64 == 0) {
+		if (level == SimdLevel::Avx512) {
+			return compress_chars_avx512(line, selected, chars);
+		}
+	}
+#endif
+	auto count = size_t{0};
+	for (auto byte_index = size_t{0}; byte_index < CACHE_LINE_SIZE; ++byte_index) {
+		chars[count] = line[byte_index];
+		count += selected[byte_index] ? 1 : 0;
+	}
+	// The last byte copied may not have been selected.
+	chars[count] = '\0';
+	return count;
+}
+
+/**
+ * Runs all stages of the pipeline on the host, one line after the other, for hosts without an FPGA. Every line goes
+ * through the same per-line functions as on the device, so the output lines and the tape are the same; the bytes are
+ * classified with vector instructions, and lines without any non-ASCII bytes, escapes or numbers skip the stages that
+ * would not change them.
+ */
+class HostPipeline {
+  public:
+	explicit HostPipeline(const SimdLevel level = detect_simd_level()) : _level(level) {}
+
+	SimdLevel simd_level() const { return _level; }
+
+	/// Start a new input, forgetting the state carried over from the previous call to run().
+	void reset() {
+		_utf8_state = Utf8State{};
+		_overflow_state = OverflowState::None;
+		_literal_state = LiteralState{};
+		_string_state = StringFilterState{};
+		_number_state = NumberState{};
+		_tape_state.state = TapeBuilderState{};
+	}
+
+	/**
+	 * Run the pipeline on the next part of the input, continuing the state of the previous call.
+	 * @param input Input, the last line is padded with whitespace.
+	 * @param input_size Size of the input in bytes.
+	 * @param input_offset Offset of the input in the whole input, used to locate errors.
+	 * @param output_cache_lines Output with room for one line per started cache line of the input.
+	 * @param tape Tape to write, with room for as many lines.
+	 * @param statuses STATUS_COUNT statuses the stages report their first error to, unless they already hold one.
+	 * @param is_end_of_input Whether the input ends with this part.
+	 * @param document_separator Byte that separates documents, see compute_bitmaps().
+	 * @param allow_empty_document Whether the input may end with an empty document.
+	 * @return The number of lines written.
+	 */
+	size_t run(const char *input, const size_t input_size, const size_t input_offset,
+			   OutputCacheLine *output_cache_lines, TapeChunk &tape, ParseStatus *statuses, const bool is_end_of_input,
+			   const char document_separator = NO_DOCUMENT_SEPARATOR, const bool allow_empty_document = false) {
+		const auto cache_line_count = (input_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+		auto stack = CarriedScopeStack{_tape_state.stack};
+		auto builder = TapeLineBuilder<CarriedScopeStack>{_tape_state.state, stack, statuses[TAPE_BUILDER_STATUS],
+														  tape, input_offset};
+
+		for (auto index = size_t{0}; index < cache_line_count; ++index) {
+			const auto line_offset = input_offset + index * CACHE_LINE_SIZE;
+			const auto length = std::min(input_size - index * CACHE_LINE_SIZE, CACHE_LINE_SIZE);
+			auto line = CacheLine{};
+			std::memcpy(line.data(), input + index * CACHE_LINE_SIZE, length);
+			std::fill(line.begin() + length, line.end(), ' ');
+
+			const auto classes = classify_host_bytes(line, document_separator, _level);
+
+			// A line of ASCII bytes is valid as long as the previous line did not end inside of a sequence.
+			if (classes.non_ascii.any() || ends_in_sequence(_utf8_state.previous)) {
+				const auto invalid = find_invalid_utf8(line, _utf8_state.previous);
+				if (invalid.any()) {
+					statuses[UTF8_VALIDATOR_STATUS].report(ErrorCode::InvalidUtf8,
+														   line_offset + lowest_set_index(invalid));
+				}
+			} else {
+				_utf8_state.previous = Utf8Classes{};
+			}
+
+			auto unexpected = Bitmap{};
+			const auto tokenized = tokenize(_overflow_state, _literal_state, line, classes.tokenizer, unexpected);
+			_overflow_state = tokenized.bitmaps.overflow_state;
+			if (unexpected.any()) {
+				statuses[TOKENIZER_STATUS].report(ErrorCode::UnexpectedCharacter,
+												  line_offset + lowest_set_index(unexpected));
+			}
+
+			auto &output = output_cache_lines[index];
+			output = _filter_strings(tokenized, classes, statuses[STRING_FILTER_STATUS], line_offset);
+			if (_number_state.in_run || tokenized.bitmaps.is_number.any()) {
+				const auto ends_document = is_end_of_input && index == cache_line_count - 1;
+				output.numbers = parse_numbers(_number_state, tokenized, statuses[NUMBER_PARSER_STATUS], line_offset,
+											   ends_document);
+			}
+
+			builder.build_line(index, output);
+		}
+
+		const auto end_offset = input_offset + cache_line_count * CACHE_LINE_SIZE;
+		if (is_end_of_input && ends_in_sequence(_utf8_state.previous)) {
+			statuses[UTF8_VALIDATOR_STATUS].report(ErrorCode::InvalidUtf8, end_offset);
+		}
+		if (is_end_of_input && is_incomplete_literal(_literal_state)) {
+			statuses[TOKENIZER_STATUS].report(ErrorCode::UnexpectedCharacter, end_offset);
+		}
+		if (is_end_of_input && _string_state.in_string) {
+			statuses[STRING_FILTER_STATUS].report(ErrorCode::UnclosedString, end_offset);
+		}
+		builder.finish(cache_line_count, is_end_of_input, allow_empty_document);
+		return cache_line_count;
+	}
+
+  private:
+	/**
+	 * Filter the strings of a line like filter_strings(). Strings without any escapes are copied as they are, which
+	 * takes a single compaction of the line instead of decoding every byte.
+	 */
+	OutputCacheLine _filter_strings(const TokenizedCacheLine &tokenized, const HostByteClasses &classes,
+									ParseStatus &status, const size_t line_offset) {
+		const auto &is_string = tokenized.bitmaps.is_string;
+		const auto &escape = _string_state.escape;
+		if ((classes.tokenizer.backslashes & is_string).any() || tokenized.bitmaps.is_escaped.any() ||
+			escape.digits_remaining != 0 || escape.high_surrogate != 0) {
+			return filter_strings(_string_state, tokenized, status, line_offset);
+		}
+
+		auto output = OutputCacheLine{};
+		output.tokens = tokenized.tokens;
+		output.token_starts = tokenized.token_starts;
+		if (!_string_state.in_string && is_string.none()) {
+			return output;
+		}
+
+		// Without escapes, every quote inside of a string opens it and everything else is copied.
+		const auto chars = is_string & ~classes.tokenizer.quotes;
+		const auto controls = chars & classes.control;
+		if (controls.any()) {
+			status.report(ErrorCode::UnescapedControlCharacter, line_offset + lowest_set_index(controls));
+		}
+		const auto char_count = compress_chars(tokenized.line, chars, output.line, _level);
+
+		// A string or string part ends right before every byte after the last one inside of it. One that continues
+		// from the previous line and ends at the first byte has no characters here, so it gets no part.
+		auto &strings = output.strings;
+		strings.continues_string = _string_state.in_string && is_string[0];
+		auto ends = ~is_string & ((is_string << 1) | Bitmap{_string_state.in_string ? 1u : 0u});
+		ends[0] = false;
+		auto copied_count = size_t{0};
+		while (ends.any()) {
+			const auto end = lowest_set_index(ends);
+			ends[end] = false;
+			const auto length = (chars & ~(~Bitmap{} << end)).count() - copied_count;
+			strings.push_length(static_cast<uint8_t>(length));
+			copied_count += length;
+		}
+		if (is_string[CACHE_LINE_SIZE - 1]) {
+			strings.push_length(static_cast<uint8_t>(char_count - copied_count));
+		}
+
+		_string_state.in_string = is_string[CACHE_LINE_SIZE - 1];
+		return output;
+	}
+
+	SimdLevel _level;
+	Utf8State _utf8_state{};
+	OverflowState _overflow_state = OverflowState::None;
+	LiteralState _literal_state{};
+	StringFilterState _string_state{};
+	NumberState _number_state{};
+	CarriedTapeBuilderState _tape_state{};
+};
@@ -1,94 +1,773 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <istream>
+#include <mutex>
 #include <sycl/sycl.hpp>
+#include <thread>
 
 #include "definitions.hpp"
+#include "host_pipeline.hpp"
+#include "mapped_file.hpp"
+#include "number_parser.hpp"
+#include "parse_error.hpp"
+#include "pipe_utils.hpp"
+#include "stage_timings.hpp"
 #include "string_filter.hpp"
 #include "tape_builder.hpp"
 #include "taped_json.hpp"
 #include "tokenizer.hpp"
+#include "utf8_validator.hpp"
 
-// Host -> Bitmap computation.
+// Every stage of the pipeline is connected to the next one with LANE_COUNT pipes, one per line of an iteration.
+
+// Host -> UTF-8 validation.
 class ProducerId;
 class InPipeId;
-using InPipe = sycl::ext::intel::experimental::pipe<InPipeId, CacheLine, PIPELINE_DEPTH>;
+using InPipes = fpga_tools::PipeArray<InPipeId, CacheLine, PIPELINE_DEPTH, LANE_COUNT>;
+
+// UTF-8 validation -> Bitmap computation (both device).
+class Utf8ValidatorId;
+class ValidatedPipeId;
+using ValidatedPipes = fpga_tools::PipeArray<ValidatedPipeId, CacheLine, PIPELINE_DEPTH, LANE_COUNT>;
 
 // Bitmap computation -> String filter (both device).
 class TokenizerId;
 class TokenizerToStringFilterPipeId;
-using TokenizerToStringFilterPipe =
-	sycl::ext::intel::pipe<TokenizerToStringFilterPipeId, TokenizedCacheLine, PIPELINE_DEPTH>;
-
-// String filter -> Tape Builder (Host).
-class StringFilterId;
-class OutPipeId;
-using OutPipe = sycl::ext::intel::experimental::pipe<OutPipeId, OutputCacheLine, PIPELINE_DEPTH>;
+using TokenizerToStringFilterPipes =
+	fpga_tools::PipeArray<TokenizerToStringFilterPipeId, TokenizedCacheLine, PIPELINE_DEPTH, LANE_COUNT>;
 
-class ConsumerId;
+// Bitmap computation -> Number parser (both device).
+class TokenizerToNumberParserPipeId;
+using TokenizerToNumberParserPipes =
+	fpga_tools::PipeArray<TokenizerToNumberParserPipeId, TokenizedCacheLine, PIPELINE_DEPTH, LANE_COUNT>;
 
-template <typename Id, typename InPipe>
-std::pair<sycl::event, size_t> submit_producer(sycl::queue &q, const std::string &input) {
-	const auto input_size = input.size();
+// Bitmap computation -> String filter and number parser of the same lane, which run side by side.
+template <size_t lane> class TokenizerOutPipeId;
+struct TokenizerOutPipes {
+	template <size_t lane>
+	using PipeAt = fpga_tools::PipeDuplicator<TokenizerOutPipeId<lane>, TokenizedCacheLine,
+											  TokenizerToStringFilterPipes::PipeAt<lane>,
+											  TokenizerToNumberParserPipes::PipeAt<lane>>;
+};
 
-	char *in;
-	if ((in = sycl::malloc_shared<char>(input_size, q)) == nullptr) {
-		std::cerr << "ERROR: could not allocate space for 'in'\n";
-		std::terminate();
-	}
+// String filter -> Tape builder (both device).
+class StringFilterId;
+class OutPipeId;
+using OutPipes = fpga_tools::PipeArray<OutPipeId, OutputCacheLine, PIPELINE_DEPTH, LANE_COUNT>;
 
-	std::memcpy(in, input.data(), input_size * sizeof(char));
+// Number parser -> Tape builder (both device).
+class NumberParserId;
+class NumberPipeId;
+using NumberPipes = fpga_tools::PipeArray<NumberPipeId, NumberCacheLine, PIPELINE_DEPTH, LANE_COUNT>;
 
-	// Check if input size is divisible by CACHE_LINE_SIZE
-	const bool underfull_cache_line = input_size % CACHE_LINE_SIZE != 0;
+class TapeBuilderId;
 
-	const auto cache_line_count = input_size / CACHE_LINE_SIZE;
+/**
+ * Stream the input to the pipeline LaneCount cache lines at a time, reading it directly from where it is stored. The
+ * last line is padded with whitespace, and so are as many whole lines as it takes to fill the last iteration.
+ * @tparam InPipes Pipes to write the cache lines to, one per lane.
+ * @tparam LaneCount Number of lines written per iteration.
+ * @param q Queue to use.
+ * @param input Input document in memory the device can access directly, e.g. allocated with sycl::malloc_host. Must
+ * stay alive until the returned event completes.
+ * @param input_size Size of the input document in bytes.
+ * @param dependencies Events to wait for before starting.
+ * @return The producer event and the number of cache lines written, a multiple of LaneCount.
+ */
+template <typename Id, typename InPipes, size_t LaneCount>
+std::pair<sycl::event, size_t> submit_producer(sycl::queue &q, const char *input, const size_t input_size,
+											   const std::vector<sycl::event> &dependencies = {}) {
+	const auto full_cache_line_count = input_size / CACHE_LINE_SIZE;
+	const auto remainder = input_size % CACHE_LINE_SIZE;
+	const auto full_group_count = full_cache_line_count / LaneCount;
+	const auto has_last_group = full_cache_line_count % LaneCount != 0 || remainder != 0;
 
 	const auto producer_event = q.submit([&](auto &h) {
+		h.depends_on(dependencies);
 		h.template single_task<Id>([=]() {
-			for (auto index = size_t{0}; index < cache_line_count; ++index) {
-				const auto *begin = in + index * CACHE_LINE_SIZE;
-				const auto *end = in + (index + 1) * CACHE_LINE_SIZE;
-				auto line = CacheLine{};
-				std::copy(begin, end, line.begin());
-				InPipe::write(line);
+			// Whole cache lines are read in a single burst each, without any staging copy.
+			const auto *lines = reinterpret_cast<const CacheLine *>(input);
+			for (auto group_index = size_t{0}; group_index < full_group_count; ++group_index) {
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					InPipes::template PipeAt<lane>::write(lines[group_index * LaneCount + lane]);
+				});
 			}
 
-			if (underfull_cache_line) {
-				const auto *begin = in + cache_line_count * CACHE_LINE_SIZE;
-				const auto *end = in + input_size;
-				auto line = CacheLine{};
-				std::copy(begin, end, line.begin());
-				std::fill(line.begin() + (input_size % CACHE_LINE_SIZE), line.end(), ' ');
-				InPipe::write(line);
+			if (has_last_group) {
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					const auto index = full_group_count * LaneCount + lane;
+					auto line = CacheLine{};
+					if (index < full_cache_line_count) {
+						line = lines[index];
+					} else {
+						const auto *begin = input + full_cache_line_count * CACHE_LINE_SIZE;
+						const auto length = index == full_cache_line_count ? remainder : 0;
+						for (auto byte_index = size_t{0}; byte_index < CACHE_LINE_SIZE; ++byte_index) {
+							line[byte_index] = byte_index < length ? begin[byte_index] : ' ';
+						}
+					}
+					InPipes::template PipeAt<lane>::write(line);
+				});
 			}
 		});
 	});
 
-	const auto final_cache_line_count = underfull_cache_line ? cache_line_count + 1 : cache_line_count;
-	return {producer_event, final_cache_line_count};
+	const auto group_count = has_last_group ? full_group_count + 1 : full_group_count;
+	return {producer_event, group_count * LaneCount};
 }
 
-TapedJson parse(sycl::queue &q, const std::string &input) {
-	// std::cout << "Started parsing." << std::endl;
+/// Default number of bytes per chunk in JsonParser::parse_stream().
+constexpr auto DEFAULT_CHUNK_SIZE = size_t{16} << 20;
+/// Number of chunks in flight in JsonParser::parse_stream(): one being processed by the device while the host builds
+/// the tape of the other.
+constexpr auto STREAM_BUFFER_COUNT = size_t{2};
+
+/// Where JsonParser runs the pipeline.
+enum class Backend : uint8_t {
+	/// The kernels on the device of the queue, usually an FPGA.
+	Device,
+	/// A HostPipeline on the calling thread, for hosts without an FPGA. Produces the same documents and errors.
+	Host,
+};
+
+/**
+ * Parser that owns its queue and the USM buffers the pipeline reads from and writes to. The buffers only ever grow and
+ * are reused by every call to parse(), so parsing documents of similar size allocates nothing in the steady state.
+ */
+class JsonParser {
+	using Clock = std::chrono::steady_clock;
+
+	/// Events of all kernels of a launch of the pipeline.
+	struct PipelineEvents {
+		sycl::event producer;
+		sycl::event utf8_validator;
+		sycl::event tokenizer;
+		sycl::event string_filter;
+		sycl::event number_parser;
+		sycl::event tape_builder;
+	};
+
+  public:
+	/**
+	 * @param q Queue to allocate the buffers with and, on Backend::Device, to run the kernels on.
+	 * @param backend Where to run the pipeline.
+	 */
+	explicit JsonParser(sycl::queue q, const Backend backend = Backend::Device)
+		: _q(std::move(q)), _backend(backend),
+		  _can_collect_early(_q.get_device().has(sycl::aspect::usm_atomic_shared_allocations)),
+		  _is_profiling(_q.has_property<sycl::property::queue::enable_profiling>()) {
+		if ((_statuses = sycl::malloc_shared<ParseStatus>(STATUS_COUNT, _q)) == nullptr) {
+			std::cerr << "ERROR: could not allocate space for the parse status\n";
+			std::terminate();
+		}
+	}
+
+	JsonParser(const JsonParser &) = delete;
+	JsonParser &operator=(const JsonParser &) = delete;
+
+	~JsonParser() {
+		if (_input != nullptr) {
+			sycl::free(_input, _q);
+		}
+		if (_output_cache_lines != nullptr) {
+			sycl::free(_output_cache_lines, _q);
+		}
+		_free_tape(_tape);
+		for (auto slot = size_t{0}; slot < STREAM_BUFFER_COUNT; ++slot) {
+			if (_stream_inputs[slot] != nullptr) {
+				sycl::free(_stream_inputs[slot], _q);
+			}
+			if (_stream_outputs[slot] != nullptr) {
+				sycl::free(_stream_outputs[slot], _q);
+			}
+			_free_tape(_stream_tapes[slot]);
+		}
+		if (_carried_tokenizer_state != nullptr) {
+			sycl::free(_carried_tokenizer_state, _q);
+		}
+		if (_carried_number_state != nullptr) {
+			sycl::free(_carried_number_state, _q);
+		}
+		if (_carried_string_state != nullptr) {
+			sycl::free(_carried_string_state, _q);
+		}
+		if (_carried_utf8_state != nullptr) {
+			sycl::free(_carried_utf8_state, _q);
+		}
+		if (_carried_tape_state != nullptr) {
+			sycl::free(_carried_tape_state, _q);
+		}
+		sycl::free(_statuses, _q);
+	}
+
+	sycl::queue &queue() { return _q; }
+
+	Backend backend() const { return _backend; }
+
+	/**
+	 * Collect the output of large parses and split it into documents with several threads, see TapeBuilder.
+	 * @param thread_count Threads to use at most, one to collect on the calling thread only.
+	 */
+	void set_host_thread_count(const size_t thread_count) { _host_thread_count = thread_count; }
+
+	/**
+	 * Share the pipeline with other parsers on the same device. All launches of the pipeline use the same pipes, so
+	 * only one parser may run it at a time; everything else, e.g. copying the input or assembling the documents, runs
+	 * concurrently. Not needed on the host backend, where every parser has a pipeline of its own.
+	 * @param pipeline_mutex Mutex held while the pipeline runs, shared by all parsers of the device. Must outlive the
+	 * parser.
+	 */
+	void set_pipeline_mutex(std::mutex *pipeline_mutex) { _pipeline_mutex = pipeline_mutex; }
+
+	/**
+	 * Allocate the buffers of parse() ahead of time, so that parsing documents up to the given size allocates nothing
+	 * on the device side.
+	 * @param input_size Size of the largest document in bytes.
+	 */
+	void reserve(const size_t input_size) {
+		const auto group_size = LANE_COUNT * CACHE_LINE_SIZE;
+		_reserve_input(input_size);
+		_reserve_output((input_size + group_size - 1) / group_size * LANE_COUNT);
+	}
+
+	/**
+	 * Parse a document that lives in host memory the device can access directly, without copying it first.
+	 * @param input Input document, e.g. allocated with sycl::malloc_host.
+	 * @param input_size Size of the input document in bytes.
+	 * @param timings If given, set to the time spent in every stage of this parse.
+	 * @return The parsed JSON document.
+	 * @throws ParseError If the input is not valid JSON.
+	 */
+	TapedJson parse(const char *input, const size_t input_size, StageTimings *timings = nullptr) {
+		const auto start_time = Clock::now();
+		auto builder = TapeBuilder{_host_thread_count};
+		const auto events = _run_pipeline(builder, input, input_size);
+		_check_status(input_size);
+		builder.append_tape(*_tape);
+
+		const auto collected_time = Clock::now();
+		auto json = builder.finish();
+		if (timings != nullptr) {
+			_record_timings(*timings, events, start_time, collected_time);
+		}
+		return json;
+	}
+
+	/**
+	 * Parse a document the device cannot access directly by first copying it into the reused input buffer. The host
+	 * backend reads the document where it is.
+	 * @param input Input document.
+	 * @param timings If given, set to the time spent in every stage of this parse.
+	 * @return The parsed JSON document.
+	 * @throws ParseError If the input is not valid JSON.
+	 */
+	TapedJson parse(const std::string &input, StageTimings *timings = nullptr) {
+		return _parse_host_memory(input.data(), input.size(), timings);
+	}
+
+	/**
+	 * Parse a memory-mapped file. The host backend reads the document straight from the mapping. The device cannot
+	 * access the mapping, so it is copied into the reused input buffer once, which also faults in its pages.
+	 * @param file Input document.
+	 * @param timings If given, set to the time spent in every stage of this parse.
+	 * @return The parsed JSON document.
+	 * @throws ParseError If the input is not valid JSON.
+	 */
+	TapedJson parse(const MappedFile &file, StageTimings *timings = nullptr) {
+		return _parse_host_memory(file.data(), file.size(), timings);
+	}
+
+	/**
+	 * Parse many documents with a single launch of the pipeline. The tokenizer marks every separator outside of a
+	 * string with a Token::DocumentEndToken, which ends a document on the tape.
+	 * @param input Input documents in memory the device can access directly, e.g. allocated with sycl::malloc_host.
+	 * @param input_size Size of the input in bytes.
+	 * @param document_separator Byte between two documents, '\n' for NDJSON.
+	 * @param timings If given, set to the time spent in every stage of this parse.
+	 * @return One parsed JSON document per non-empty document in the input.
+	 * @throws ParseError If any of the documents is not valid JSON.
+	 */
+	std::vector<TapedJson> parse_documents(const char *input, const size_t input_size,
+										   const char document_separator = '\n', StageTimings *timings = nullptr) {
+		const auto start_time = Clock::now();
+		auto builder = TapeBuilder{_host_thread_count};
+		const auto events = _run_pipeline(builder, input, input_size, document_separator);
+		_check_status(input_size);
+		builder.append_tape(*_tape);
+
+		const auto collected_time = Clock::now();
+		auto documents = builder.finish_documents();
+		if (timings != nullptr) {
+			_record_timings(*timings, events, start_time, collected_time);
+		}
+		return documents;
+	}
+
+	/**
+	 * Parse newline-delimited JSON with a single launch of the pipeline.
+	 * @param input One JSON document per line.
+	 * @return One parsed JSON document per non-empty line.
+	 */
+	std::vector<TapedJson> parse_ndjson(const std::string &input) {
+		_reserve_input(input.size());
+		std::memcpy(_input, input.data(), input.size() * sizeof(char));
+
+		return parse_documents(_input, input.size(), '\n');
+	}
+
+	/**
+	 * Parse a batch of arbitrary documents with a single launch of the pipeline. The documents are joined with the
+	 * ASCII record separator, as in JSON text sequences (RFC 7464), which may not occur in JSON text.
+	 * @param documents Documents to parse.
+	 * @return One parsed JSON document per document, in the same order.
+	 * @throws ParseError If any of the documents is empty or not valid JSON, with the index of the first such document
+	 * and the offset within it.
+	 */
+	std::vector<TapedJson> parse_batch(const std::vector<std::string> &documents) {
+		constexpr auto RECORD_SEPARATOR = '\x1e';
+		if (documents.empty()) {
+			return {};
+		}
+
+		// Empty documents would just vanish from the joined input, which would shift the indices of all later ones.
+		auto document_begins = std::vector<size_t>{};
+		document_begins.reserve(documents.size());
+		auto input_size = size_t{0};
+		for (auto index = size_t{0}; index < documents.size(); ++index) {
+			const auto &document = documents[index];
+			if (document.find_first_not_of(" \t\n\r") == std::string::npos) {
+				throw ParseError{ParseStatus{ErrorCode::EmptyDocument, document.size()}, index};
+			}
+			document_begins.push_back(input_size);
+			input_size += document.size() + 1;
+		}
+		_reserve_input(input_size);
+
+		auto *position = _input;
+		for (const auto &document : documents) {
+			position = std::copy(document.begin(), document.end(), position);
+			*position++ = RECORD_SEPARATOR;
+		}
+
+		try {
+			return parse_documents(_input, input_size, RECORD_SEPARATOR);
+		} catch (const ParseError &e) {
+			// An error at a record separator belongs to the document it ends.
+			const auto next_begin = std::upper_bound(document_begins.begin(), document_begins.end(), e.offset());
+			const auto index = static_cast<size_t>(next_begin - document_begins.begin()) - 1;
+			throw ParseError{ParseStatus{e.code(), e.offset() - document_begins[index]}, index};
+		}
+	}
+
+	/**
+	 * Parse a document of any size by streaming it through the pipeline in fixed-size chunks. Input and output are
+	 * double buffered: while the device works on one chunk, the host reads the next one and collects the output of the
+	 * previous one. Only a small state per kernel, e.g. the partially parsed number or the stack of open scopes, is
+	 * carried from one chunk to the next, so the pipeline buffers stay bounded by the chunk size.
+	 * @param input Stream to read the document from.
+	 * @param chunk_size Bytes per chunk, rounded up to a whole number of iterations of LANE_COUNT cache lines.
+	 * @return The parsed JSON document.
+	 * @throws ParseError If the input is not valid JSON.
+	 */
+	TapedJson parse_stream(std::istream &input, const size_t chunk_size = DEFAULT_CHUNK_SIZE) {
+		// Every chunk but the last one has to fill whole iterations of the pipeline, so no padding ends up in between.
+		const auto chunk_group_size = LANE_COUNT * CACHE_LINE_SIZE;
+		const auto chunk_line_count =
+			std::max((chunk_size + chunk_group_size - 1) / chunk_group_size, size_t{1}) * LANE_COUNT;
+		_reserve_stream(chunk_line_count);
+		if (_backend == Backend::Host) {
+			return _parse_stream_on_host(input, chunk_line_count);
+		}
+		const auto pipeline_lock = _lock_pipeline();
+		*_carried_tokenizer_state = TokenizerState{};
+		*_carried_number_state = NumberState{};
+		*_carried_string_state = StringFilterState{};
+		*_carried_utf8_state = Utf8State{};
+		_carried_tape_state->state = TapeBuilderState{};
+		_reset_statuses();
+
+		auto builder = TapeBuilder{_host_thread_count};
+		auto line_counts = std::array<size_t, STREAM_BUFFER_COUNT>{};
+		auto input_sizes = std::array<size_t, STREAM_BUFFER_COUNT>{};
+		auto input_offsets = std::array<size_t, STREAM_BUFFER_COUNT>{};
+		auto producer_events = std::array<sycl::event, STREAM_BUFFER_COUNT>{};
+		auto tape_builder_events = std::array<sycl::event, STREAM_BUFFER_COUNT>{};
+		// Every stage of a chunk waits for the same stage of the previous chunk, so chunks never mix in the pipes.
+		auto utf8_validator_event = sycl::event{};
+		auto tokenizer_event = sycl::event{};
+		auto string_filter_event = sycl::event{};
+		auto number_parser_event = sycl::event{};
+
+		auto input_offset = size_t{0};
+		auto is_end_of_input = false;
+		for (auto chunk_index = size_t{0}; !is_end_of_input; ++chunk_index) {
+			const auto slot = chunk_index % STREAM_BUFFER_COUNT;
+			const auto previous_slot = (chunk_index + STREAM_BUFFER_COUNT - 1) % STREAM_BUFFER_COUNT;
+
+			// The producer that used this slot before has to be done reading it before we overwrite it.
+			producer_events[slot].wait();
+			input.read(_stream_inputs[slot], static_cast<std::streamsize>(chunk_line_count * CACHE_LINE_SIZE));
+			const auto input_size = static_cast<size_t>(input.gcount());
+			is_end_of_input = input.peek() == std::char_traits<char>::eof();
+			input_sizes[slot] = input_size;
+			input_offsets[slot] = input_offset;
 
-	const auto [producer_event, cache_line_count] = submit_producer<ProducerId, InPipe>(q, input);
-	// std::cout << "Submitted Producer." << std::endl;
+			const auto previous_producer_event = producer_events[previous_slot];
+			const auto previous_tape_builder_event = tape_builder_events[previous_slot];
+			std::tie(producer_events[slot], line_counts[slot]) =
+				submit_producer<ProducerId, InPipes, LANE_COUNT>(_q, _stream_inputs[slot], input_size,
+																 {previous_producer_event});
+			utf8_validator_event = submit_utf8_validator<Utf8ValidatorId, InPipes, ValidatedPipes, LANE_COUNT>(
+				_q, line_counts[slot], &_statuses[UTF8_VALIDATOR_STATUS], input_offset, _carried_utf8_state,
+				is_end_of_input, {utf8_validator_event});
+			tokenizer_event = submit_tokenizer<TokenizerId, ValidatedPipes, TokenizerOutPipes, LANE_COUNT>(
+				_q, line_counts[slot], &_statuses[TOKENIZER_STATUS], input_offset, _carried_tokenizer_state,
+				is_end_of_input, {tokenizer_event});
+			string_filter_event =
+				submit_string_filter<StringFilterId, TokenizerToStringFilterPipes, OutPipes, LANE_COUNT>(
+					_q, line_counts[slot], &_statuses[STRING_FILTER_STATUS], input_offset, _carried_string_state,
+					is_end_of_input, {string_filter_event});
+			number_parser_event =
+				submit_number_parser<NumberParserId, TokenizerToNumberParserPipes, NumberPipes, LANE_COUNT>(
+					_q, line_counts[slot], &_statuses[NUMBER_PARSER_STATUS], input_offset, _carried_number_state,
+					is_end_of_input, {number_parser_event});
+			_stream_tapes[slot]->line_count = 0;
+			tape_builder_events[slot] = submit_tape_builder<TapeBuilderId, OutPipes, NumberPipes, LANE_COUNT>(
+				_q, line_counts[slot], _stream_outputs[slot], _stream_tapes[slot], &_statuses[TAPE_BUILDER_STATUS],
+				input_offset, _carried_tape_state, is_end_of_input, false, {previous_tape_builder_event});
+			input_offset += input_size;
 
-	const auto tokenizer_event =
-		submit_tokenizer<TokenizerId, InPipe, TokenizerToStringFilterPipe>(q, cache_line_count);
-	// std::cout << "Submitted Tokenizer." << std::endl;
+			// Collect the tape of the previous chunk while the device works on this one.
+			if (chunk_index > 0) {
+				tape_builder_events[previous_slot].wait();
+				builder.set_input(_stream_inputs[previous_slot], input_sizes[previous_slot],
+								  input_offsets[previous_slot]);
+				builder.append(line_counts[previous_slot], _stream_outputs[previous_slot],
+							   *_stream_tapes[previous_slot]);
+			}
+
+			if (is_end_of_input) {
+				tape_builder_events[slot].wait();
+				builder.set_input(_stream_inputs[slot], input_size, input_offsets[slot]);
+				builder.append(line_counts[slot], _stream_outputs[slot], *_stream_tapes[slot]);
+			}
+		}
+
+		utf8_validator_event.wait();
+		tokenizer_event.wait();
+		string_filter_event.wait();
+		number_parser_event.wait();
+		_check_status(input_offset);
+		return builder.finish();
+	}
+
+  private:
+	/// parse_stream() on the host, which parses one chunk after the other into the first slot of the stream buffers.
+	TapedJson _parse_stream_on_host(std::istream &input, const size_t chunk_line_count) {
+		_host_pipeline.reset();
+		_reset_statuses();
+
+		auto builder = TapeBuilder{_host_thread_count};
+		auto input_offset = size_t{0};
+		for (auto is_end_of_input = false; !is_end_of_input;) {
+			input.read(_stream_inputs[0], static_cast<std::streamsize>(chunk_line_count * CACHE_LINE_SIZE));
+			const auto input_size = static_cast<size_t>(input.gcount());
+			is_end_of_input = input.peek() == std::char_traits<char>::eof();
+
+			const auto line_count = _host_pipeline.run(_stream_inputs[0], input_size, input_offset, _stream_outputs[0],
+													   *_stream_tapes[0], _statuses, is_end_of_input);
+			builder.set_input(_stream_inputs[0], input_size, input_offset);
+			builder.append(line_count, _stream_outputs[0], *_stream_tapes[0]);
+			input_offset += input_size;
+		}
+
+		_check_status(input_offset);
+		return builder.finish();
+	}
+
+	/**
+	 * Run the pipeline on the input and collect the strings and numbers of its output while the device still works on
+	 * the remaining lines. The tape is left to append once the status is checked.
+	 * @param builder Builder to collect the output lines into.
+	 * @param input Input in memory the device can access directly.
+	 * @param input_size Size of the input in bytes.
+	 * @return The events of all kernels, all of them complete. None on the host backend.
+	 */
+	PipelineEvents _run_pipeline(TapeBuilder &builder, const char *input, const size_t input_size,
+								 const char document_separator = NO_DOCUMENT_SEPARATOR) {
+		const auto allow_empty_document = document_separator != NO_DOCUMENT_SEPARATOR;
+		builder.set_input(input, input_size, 0);
+		if (_backend == Backend::Host) {
+			_reserve_output((input_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+			_reset_statuses();
+			_host_pipeline.reset();
+			const auto cache_line_count = _host_pipeline.run(input, input_size, 0, _output_cache_lines, *_tape,
+															 _statuses, true, document_separator, allow_empty_document);
+			builder.append_lines(cache_line_count, _output_cache_lines);
+			return {};
+		}
+
+		const auto pipeline_lock = _lock_pipeline();
+		auto [producer_event, cache_line_count] =
+			submit_producer<ProducerId, InPipes, LANE_COUNT>(_q, input, input_size);
 
-	const auto string_filter_event =
-		submit_string_filter<StringFilterId, TokenizerToStringFilterPipe, OutPipe>(q, cache_line_count);
-	// std::cout << "Submitted String FIlter." << std::endl;
+		_reserve_output(cache_line_count);
+		_reset_statuses();
+		_tape->line_count = 0;
 
-	auto [consumer_event, output_cache_lines] = submit_consumer<ConsumerId, OutPipe>(q, cache_line_count);
-	// std::cout << "Submitted Consumer." << std::endl;
+		auto utf8_validator_event = submit_utf8_validator<Utf8ValidatorId, InPipes, ValidatedPipes, LANE_COUNT>(
+			_q, cache_line_count, &_statuses[UTF8_VALIDATOR_STATUS], 0);
 
-	consumer_event.wait();
+		auto tokenizer_event = submit_tokenizer<TokenizerId, ValidatedPipes, TokenizerOutPipes, LANE_COUNT>(
+			_q, cache_line_count, &_statuses[TOKENIZER_STATUS], 0, nullptr, true, {}, document_separator);
+
+		auto string_filter_event =
+			submit_string_filter<StringFilterId, TokenizerToStringFilterPipes, OutPipes, LANE_COUNT>(
+				_q, cache_line_count, &_statuses[STRING_FILTER_STATUS], 0);
+
+		auto number_parser_event =
+			submit_number_parser<NumberParserId, TokenizerToNumberParserPipes, NumberPipes, LANE_COUNT>(
+				_q, cache_line_count, &_statuses[NUMBER_PARSER_STATUS], 0);
+
+		auto tape_builder_event = submit_tape_builder<TapeBuilderId, OutPipes, NumberPipes, LANE_COUNT>(
+			_q, cache_line_count, _output_cache_lines, _tape, &_statuses[TAPE_BUILDER_STATUS], 0, nullptr, true,
+			allow_empty_document);
+
+		auto collected_count = size_t{0};
+		if (_can_collect_early) {
+			const auto line_count = LineCountRef{_tape->line_count};
+			while (collected_count < cache_line_count) {
+				const auto published_count = line_count.load(sycl::memory_order::acquire);
+				if (published_count > collected_count) {
+					builder.append_lines(published_count - collected_count, _output_cache_lines + collected_count);
+					collected_count = published_count;
+				} else if (tape_builder_event.get_info<sycl::info::event::command_execution_status>() ==
+						   sycl::info::event_command_status::complete) {
+					break;
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		tape_builder_event.wait();
+		producer_event.wait();
+		utf8_validator_event.wait();
+		tokenizer_event.wait();
+		string_filter_event.wait();
+		number_parser_event.wait();
+		builder.append_lines(cache_line_count - collected_count, _output_cache_lines + collected_count);
+
+		return {producer_event, utf8_validator_event, tokenizer_event, string_filter_event, number_parser_event,
+				tape_builder_event};
+	}
+
+	/**
+	 * Fill in the timings of a parse from the events of its kernels and the host time taken up to the given points.
+	 * @param start_time When the parse started.
+	 * @param collected_time When the output of the device was collected and the documents could be assembled.
+	 */
+	void _record_timings(StageTimings &timings, const PipelineEvents &events, const Clock::time_point start_time,
+						 const Clock::time_point collected_time) const {
+		timings = StageTimings{};
+		if (_is_profiling && _backend == Backend::Device) {
+			timings.producer = kernel_duration(events.producer);
+			timings.utf8_validator = kernel_duration(events.utf8_validator);
+			timings.tokenizer = kernel_duration(events.tokenizer);
+			timings.string_filter = kernel_duration(events.string_filter);
+			timings.number_parser = kernel_duration(events.number_parser);
+			timings.tape_builder = kernel_duration(events.tape_builder);
+			timings.device = device_duration({events.producer, events.utf8_validator, events.tokenizer,
+											  events.string_filter, events.number_parser, events.tape_builder});
+		}
+		const auto end_time = Clock::now();
+		timings.collect = collected_time - start_time;
+		timings.finish = end_time - collected_time;
+		timings.total = end_time - start_time;
+	}
+
+	/// Hold the pipeline mutex, if any, until the returned lock goes out of scope.
+	std::unique_lock<std::mutex> _lock_pipeline() {
+		return _pipeline_mutex != nullptr ? std::unique_lock<std::mutex>{*_pipeline_mutex}
+										  : std::unique_lock<std::mutex>{};
+	}
 
-	const auto taped_json = build_tape(cache_line_count, output_cache_lines);
-	// std::cout << "Finished Parsing." << std::endl;
+	void _reset_statuses() { std::fill(_statuses, _statuses + STATUS_COUNT, ParseStatus{}); }
 
-	return taped_json;
+	/**
+	 * Throw the first error found by the device. Errors in the bytes take precedence over structural errors, as the
+	 * tape builder only sees their consequences.
+	 * @param input_size Size of the input, errors at the end of the input are reported there instead of in the
+	 * padding of the last line.
+	 */
+	void _check_status(const size_t input_size) const {
+		auto status = ParseStatus{};
+		for (auto index = size_t{0}; index < TAPE_BUILDER_STATUS; ++index) {
+			if (_statuses[index].code != ErrorCode::None &&
+				(status.code == ErrorCode::None || _statuses[index].offset < status.offset)) {
+				status = _statuses[index];
+			}
+		}
+		status.report(_statuses[TAPE_BUILDER_STATUS].code, _statuses[TAPE_BUILDER_STATUS].offset);
+
+		if (status.code != ErrorCode::None) {
+			status.offset = std::min(status.offset, input_size);
+			throw ParseError{status};
+		}
+	}
+
+	/// Parse a document in host memory the device cannot access, copying it into the input buffer unless the pipeline
+	/// runs on the host.
+	TapedJson _parse_host_memory(const char *input, const size_t input_size, StageTimings *timings) {
+		if (_backend == Backend::Host) {
+			return parse(input, input_size, timings);
+		}
+		const auto start_time = Clock::now();
+		_reserve_input(input_size);
+		std::memcpy(_input, input, input_size * sizeof(char));
+		const auto input_copy = Clock::now() - start_time;
+
+		auto json = parse(_input, input_size, timings);
+		if (timings != nullptr) {
+			timings->input_copy = input_copy;
+			timings->total += input_copy;
+		}
+		return json;
+	}
+
+	void _reserve_input(const size_t size) {
+		if (size <= _input_capacity) {
+			return;
+		}
+		if (_input != nullptr) {
+			sycl::free(_input, _q);
+		}
+		if ((_input = sycl::malloc_shared<char>(size, _q)) == nullptr) {
+			std::cerr << "ERROR: could not allocate space for 'in'\n";
+			std::terminate();
+		}
+		_input_capacity = size;
+	}
+
+	void _reserve_output(const size_t required_line_count) {
+		// Even an empty input needs a tape, which reports it as an empty document.
+		const auto cache_line_count = std::max(required_line_count, size_t{1});
+		if (cache_line_count <= _output_capacity) {
+			return;
+		}
+		if (_output_cache_lines != nullptr) {
+			sycl::free(_output_cache_lines, _q);
+		}
+		if ((_output_cache_lines = sycl::malloc_shared<OutputCacheLine>(cache_line_count, _q)) == nullptr) {
+			std::cerr << "ERROR: could not allocate space for 'output_cache_lines'\n";
+			std::terminate();
+		}
+		_free_tape(_tape);
+		_tape = _allocate_tape(cache_line_count);
+		_output_capacity = cache_line_count;
+	}
+
+	/// Allocate the tape of a launch with room for the given number of cache lines.
+	TapeChunk *_allocate_tape(const size_t cache_line_count) {
+		auto *tape = sycl::malloc_shared<TapeChunk>(1, _q);
+		if (tape == nullptr) {
+			std::cerr << "ERROR: could not allocate space for the tape\n";
+			std::terminate();
+		}
+		tape->nodes = sycl::malloc_shared<TapeNode>(max_tape_size(cache_line_count), _q);
+		tape->patches = sycl::malloc_shared<TapePatch>(MAX_TAPE_PATCHES, _q);
+		if (tape->nodes == nullptr || tape->patches == nullptr) {
+			std::cerr << "ERROR: could not allocate space for the tape\n";
+			std::terminate();
+		}
+		return tape;
+	}
+
+	void _free_tape(TapeChunk *tape) {
+		if (tape != nullptr) {
+			sycl::free(tape->nodes, _q);
+			sycl::free(tape->patches, _q);
+			sycl::free(tape, _q);
+		}
+	}
+
+	void _reserve_stream(const size_t chunk_line_count) {
+		if (_carried_tokenizer_state == nullptr) {
+			_carried_tokenizer_state = sycl::malloc_shared<TokenizerState>(1, _q);
+			_carried_number_state = sycl::malloc_shared<NumberState>(1, _q);
+			_carried_string_state = sycl::malloc_shared<StringFilterState>(1, _q);
+			_carried_utf8_state = sycl::malloc_shared<Utf8State>(1, _q);
+			_carried_tape_state = sycl::malloc_shared<CarriedTapeBuilderState>(1, _q);
+			if (_carried_tokenizer_state == nullptr || _carried_number_state == nullptr ||
+				_carried_string_state == nullptr || _carried_utf8_state == nullptr || _carried_tape_state == nullptr) {
+				std::cerr << "ERROR: could not allocate space for the carried state\n";
+				std::terminate();
+			}
+		}
+		if (chunk_line_count <= _stream_capacity) {
+			return;
+		}
+		for (auto slot = size_t{0}; slot < STREAM_BUFFER_COUNT; ++slot) {
+			if (_stream_inputs[slot] != nullptr) {
+				sycl::free(_stream_inputs[slot], _q);
+			}
+			if (_stream_outputs[slot] != nullptr) {
+				sycl::free(_stream_outputs[slot], _q);
+			}
+			_free_tape(_stream_tapes[slot]);
+			_stream_inputs[slot] = sycl::malloc_host<char>(chunk_line_count * CACHE_LINE_SIZE, _q);
+			_stream_outputs[slot] = sycl::malloc_shared<OutputCacheLine>(chunk_line_count, _q);
+			_stream_tapes[slot] = _allocate_tape(chunk_line_count);
+			if (_stream_inputs[slot] == nullptr || _stream_outputs[slot] == nullptr) {
+				std::cerr << "ERROR: could not allocate space for the stream buffers\n";
+				std::terminate();
+			}
+		}
+		_stream_capacity = chunk_line_count;
+	}
+
+	sycl::queue _q;
+	Backend _backend;
+	HostPipeline _host_pipeline;
+	size_t _host_thread_count = 1;
+	std::mutex *_pipeline_mutex = nullptr;
+	/// Whether the host can read the progress of the device from shared memory while a kernel runs.
+	bool _can_collect_early;
+	/// Whether the queue records when kernels start and end, see StageTimings.
+	bool _is_profiling;
+	char *_input = nullptr;
+	size_t _input_capacity = 0;
+	OutputCacheLine *_output_cache_lines = nullptr;
+	/// Tape of parse() and parse_documents(), with room for _output_capacity cache lines.
+	TapeChunk *_tape = nullptr;
+	size_t _output_capacity = 0;
+	/// Ring of chunk buffers for parse_stream(), all with room for _stream_capacity cache lines.
+	std::array<char *, STREAM_BUFFER_COUNT> _stream_inputs{};
+	std::array<OutputCacheLine *, STREAM_BUFFER_COUNT> _stream_outputs{};
+	std::array<TapeChunk *, STREAM_BUFFER_COUNT> _stream_tapes{};
+	size_t _stream_capacity = 0;
+	TokenizerState *_carried_tokenizer_state = nullptr;
+	NumberState *_carried_number_state = nullptr;
+	StringFilterState *_carried_string_state = nullptr;
+	Utf8State *_carried_utf8_state = nullptr;
+	CarriedTapeBuilderState *_carried_tape_state = nullptr;
+	/// One status per device stage that reports errors, so that no two kernels write the same status.
+	ParseStatus *_statuses = nullptr;
+};
+
+/**
+ * Parse a single document with buffers that are freed again afterwards. Prefer a JsonParser when parsing repeatedly.
+ * @see JsonParser::parse(const char *, size_t)
+ */
+TapedJson parse(sycl::queue &q, const char *input, const size_t input_size) {
+	return JsonParser{q}.parse(input, input_size);
 }
+
+/**
+ * Parse a single document with buffers that are freed again afterwards. Prefer a JsonParser when parsing repeatedly.
+ * @see JsonParser::parse(const std::string &)
+ */
+TapedJson parse(sycl::queue &q, const std::string &input) { return JsonParser{q}.parse(input); }
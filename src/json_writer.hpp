@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/// Default capacity of a BufferedWriter, large enough that writing to the stream is rare.
+constexpr auto DEFAULT_WRITE_BUFFER_SIZE = size_t{1} << 16;
+
+/**
+ * Table that maps every byte to how it is written inside a quoted string: 0 if it is written as is, 'u' if it is
+ * written as \u00XX, and otherwise the character that follows the backslash of its short escape, e.g. 'n' for '\n'.
+ */
+using EscapeTable = std::array<char, 256>;
+
+/// Escapes of JSON (RFC 8259): quotes, backslashes and all control characters.
+constexpr EscapeTable make_json_escape_table() {
+	auto table = EscapeTable{};
+	for (auto byte = 0; byte < 0x20; ++byte) {
+		table[byte] = 'u';
+	}
+	table['\b'] = 'b';
+	table['\f'] = 'f';
+	table['\n'] = 'n';
+	table['\r'] = 'r';
+	table['\t'] = 't';
+	table['"'] = '"';
+	table['\\'] = '\\';
+	return table;
+}
+
+/// Escapes of the debug output of TapedJson::print_tape(), which keeps every line of the tape on a line of its own.
+constexpr EscapeTable make_tape_escape_table() {
+	auto table = EscapeTable{};
+	table['\n'] = 'n';
+	table['"'] = '"';
+	table['\\'] = '\\';
+	return table;
+}
+
+constexpr auto JSON_ESCAPES = make_json_escape_table();
+constexpr auto TAPE_ESCAPES = make_tape_escape_table();
+
+/**
+ * Collects output in a buffer of its own and hands it to a stream in large blocks, so that writing many small pieces,
+ * e.g. one per node of a tape, does not go through the stream every time. Flushes when it goes out of scope.
+ */
+class BufferedWriter {
+  public:
+	/**
+	 * @param os Stream to write to.
+	 * @param capacity Bytes to collect before writing them to the stream.
+	 */
+	explicit BufferedWriter(std::ostream &os, const size_t capacity = DEFAULT_WRITE_BUFFER_SIZE)
+		: _os(os), _capacity(capacity) {
+		_buffer.reserve(capacity);
+	}
+
+	BufferedWriter(const BufferedWriter &) = delete;
+	BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+	~BufferedWriter() { flush(); }
+
+	/// Write the collected output to the stream.
+	void flush() {
+		_os.write(_buffer.data(), static_cast<std::streamsize>(_buffer.size()));
+		_buffer.clear();
+	}
+
+	void put(const char c) {
+		_buffer.push_back(c);
+		_flush_if_full();
+	}
+
+	void write(const std::string_view text) {
+		_buffer.append(text);
+		_flush_if_full();
+	}
+
+	/// Write a character count times, e.g. to indent.
+	void write_repeated(const char c, const size_t count) {
+		_buffer.append(count, c);
+		_flush_if_full();
+	}
+
+	template <typename Integer> void write_integer(const Integer value) {
+		auto digits = std::array<char, 24>{};
+		const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+		write({digits.data(), static_cast<size_t>(end - digits.data())});
+	}
+
+	/// Write the shortest decimal that reads back as the same value, always with a fraction or an exponent so that it
+	/// reads back as a float. JSON has no infinities or NaNs, so they are written as null.
+	void write_float(const double value) {
+		if (!std::isfinite(value)) {
+			write("null");
+			return;
+		}
+		auto digits = std::array<char, 32>{};
+		const auto end = std::to_chars(digits.data(), digits.data() + digits.size(), value).ptr;
+		const auto text = std::string_view{digits.data(), static_cast<size_t>(end - digits.data())};
+		write(text);
+		if (text.find_first_of(".e") == std::string_view::npos) {
+			write(".0");
+		}
+	}
+
+	/// Write a float like std::ostream does by default, i.e. with six significant digits.
+	void write_float_short(const double value) {
+		auto digits = std::array<char, 32>{};
+		const auto length = std::snprintf(digits.data(), digits.size(), "%g", value);
+		write({digits.data(), static_cast<size_t>(length)});
+	}
+
+	/**
+	 * Write the characters of a string, without the quotes around it. Runs of characters without escapes are copied
+	 * as a whole.
+	 * @param text Characters to write.
+	 * @param escapes Which characters to escape, and how.
+	 */
+	void write_escaped(const std::string_view text, const EscapeTable &escapes) {
+		constexpr auto HEX_DIGITS = std::string_view{"0123456789abcdef"};
+		auto run_begin = size_t{0};
+		for (auto index = size_t{0}; index < text.size(); ++index) {
+			const auto byte = static_cast<uint8_t>(text[index]);
+			const auto escape = escapes[byte];
+			if (escape == 0) {
+				continue;
+			}
+			_buffer.append(text.data() + run_begin, index - run_begin);
+			_buffer.push_back('\\');
+			_buffer.push_back(escape);
+			if (escape == 'u') {
+				_buffer.append("00");
+				_buffer.push_back(HEX_DIGITS[byte >> 4]);
+				_buffer.push_back(HEX_DIGITS[byte & 0xF]);
+			}
+			run_begin = index + 1;
+		}
+		_buffer.append(text.data() + run_begin, text.size() - run_begin);
+		_flush_if_full();
+	}
+
+  private:
+	void _flush_if_full() {
+		if (_buffer.size() >= _capacity) {
+			flush();
+		}
+	}
+
+	std::ostream &_os;
+	size_t _capacity;
+	std::string _buffer;
+};
@@ -1,5 +1,5 @@
-#include <fstream>
 #include <iostream>
+#include <system_error>
 
 // oneAPI headers
 #include <sycl/ext/intel/fpga_extensions.hpp>
@@ -7,6 +7,7 @@
 
 #include "exception_handler.hpp"
 #include "json_parser.hpp"
+#include "mapped_file.hpp"
 #include "simdjson/simdjson.h"
 #include "taped_json.hpp"
 
@@ -33,18 +34,17 @@ int main(int argc, char **argv) {
 
 		std::cout << "Running on device: " << device.get_info<sycl::info::device::name>().c_str() << std::endl;
 
-		auto input = std::string{
-			R"({"k":"value", "k\"y": "\"",   "key": "unescaped\"", "empty:": "", "thisisareallylongstringitinvolvesmultiplecachelines": "blub\nmore"})"};
 		if (argc > 1) {
-			const auto filename = argv[1];
-			std::ifstream file(filename);
-			if (!file.is_open()) {
-				std::cerr << "Could not open file: " << filename << std::endl;
-				return EXIT_FAILURE;
-			}
-			input = std::string{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+			// Map the file instead of reading it, so it is only copied once, into memory the device can stream from.
+			const auto file = MappedFile{argv[1], MapOptions{true}};
+			auto taped_json = JsonParser{q}.parse(file);
+			taped_json.print_tape();
+			return EXIT_SUCCESS;
 		}
 
+		const auto input = std::string{
+			R"({"k":"value", "k\"y": "\"",   "key": "unescaped\"", "empty:": "", "thisisareallylongstringitinvolvesmultiplecachelines": "blub\nmore"})"};
+
 		// simdjson::ondemand::parser parser;
 		// simdjson::padded_string json = simdjson::padded_string::load("../data/processed/twitter_trimmed.json");
 		// simdjson::ondemand::document tweets = parser.iterate(json);
@@ -70,6 +70,12 @@ int main(int argc, char **argv) {
 						 "-DFPGA_EMULATOR.\n";
 		}
 		std::terminate();
+	} catch (const ParseError &e) {
+		std::cerr << e.what() << "\n";
+		return EXIT_FAILURE;
+	} catch (const std::system_error &e) {
+		std::cerr << e.what() << "\n";
+		return EXIT_FAILURE;
 	}
 
 	return EXIT_SUCCESS;
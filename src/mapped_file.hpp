@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// How MappedFile brings the pages of a file into memory.
+struct MapOptions {
+	/// Read the whole file while mapping it (MAP_POPULATE), so that reading the mapping never faults on a page.
+	bool populate = false;
+	/// Tell the kernel that the mapping is read front to back (MADV_SEQUENTIAL), so it reads ahead aggressively.
+	bool sequential = true;
+	/// Start reading the whole file in the background right away (MADV_WILLNEED).
+	bool will_need = false;
+};
+
+/**
+ * Read-only memory mapping of a whole file, so that loading a document costs page faults instead of copies. The mapping
+ * is not padded: the pipeline pads the last cache line itself, in the producer on the device and in HostPipeline on the
+ * host, so the file never has to be copied into a larger buffer.
+ */
+class MappedFile {
+  public:
+	/**
+	 * @param filename File to map.
+	 * @param options How to bring the pages of the file into memory.
+	 * @throws std::system_error If the file cannot be opened or mapped.
+	 */
+	explicit MappedFile(const std::string &filename, const MapOptions &options = {}) {
+		const auto descriptor = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (descriptor == -1) {
+			throw std::system_error{errno, std::generic_category(), "could not open " + filename};
+		}
+		struct stat file_status {};
+		if (::fstat(descriptor, &file_status) == -1) {
+			const auto error = errno;
+			::close(descriptor);
+			throw std::system_error{error, std::generic_category(), "could not stat " + filename};
+		}
+		_size = static_cast<size_t>(file_status.st_size);
+
+		// An empty mapping is invalid, an empty file maps to no memory at all.
+		if (_size != 0) {
+			const auto flags = MAP_PRIVATE | (options.populate ? MAP_POPULATE : 0);
+			auto *data = ::mmap(nullptr, _size, PROT_READ, flags, descriptor, 0);
+			if (data == MAP_FAILED) {
+				const auto error = errno;
+				::close(descriptor);
+				throw std::system_error{error, std::generic_category(), "could not map " + filename};
+			}
+			_data = static_cast<const char *>(data);
+			// Advice only affects performance, so failing to give it is not an error.
+			if (options.sequential) {
+				(void)::madvise(data, _size, MADV_SEQUENTIAL);
+			}
+			if (options.will_need) {
+				(void)::madvise(data, _size, MADV_WILLNEED);
+			}
+		}
+		// The mapping stays valid after closing the descriptor.
+		::close(descriptor);
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	MappedFile(MappedFile &&other) noexcept
+		: _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)) {}
+
+	MappedFile &operator=(MappedFile &&other) noexcept {
+		if (this != &other) {
+			_unmap();
+			_data = std::exchange(other._data, nullptr);
+			_size = std::exchange(other._size, 0);
+		}
+		return *this;
+	}
+
+	~MappedFile() { _unmap(); }
+
+	/// First byte of the file, nullptr for an empty file.
+	const char *data() const { return _data; }
+
+	/// Size of the file in bytes.
+	size_t size() const { return _size; }
+
+	std::string_view view() const { return {_data, _size}; }
+
+  private:
+	void _unmap() {
+		if (_data != nullptr) {
+			::munmap(const_cast<char *>(_data), _size);
+		}
+	}
+
+	const char *_data = nullptr;
+	size_t _size = 0;
+};
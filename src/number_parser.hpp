@@ -0,0 +1,477 @@
+#pragma once
+
+#include "definitions.hpp"
+#include "power_of_five.hpp"
+#include "unrolled_loop.hpp"
+#include <array>
+#include <limits>
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#include <sycl/sycl.hpp>
+
+/// Most significant decimal digits that always fit into the mantissa without overflowing.
+constexpr auto MAX_MANTISSA_DIGITS = uint8_t{19};
+/// Explicit exponents are clamped to this magnitude, anything beyond saturates to zero or infinity anyway.
+constexpr auto MAX_EXPONENT = int32_t{1000};
+
+/// Partially parsed number, carried across cache lines.
+struct NumberState {
+	/// Whether we are inside a run of number characters.
+	bool in_run;
+	/// Whether the current run started with a digit or minus, i.e. produces a number.
+	bool is_valid;
+	bool is_negative;
+	bool is_float;
+	bool in_fraction;
+	bool in_exponent;
+	bool is_exponent_negative;
+	/// Number of significant digits in the mantissa.
+	uint8_t digit_count;
+	uint64_t mantissa;
+	/// Decimal exponent implied by fraction digits and digits dropped from the mantissa.
+	int32_t implied_exponent;
+	/// Exponent given after 'e' or 'E'.
+	int32_t explicit_exponent;
+	/// Whether the integer part starts with a zero, which may not be followed by more digits.
+	bool has_leading_zero;
+	/// Whether a non-zero digit did not fit into the mantissa, i.e. the number lies strictly between mantissa and
+	/// mantissa + 1 times its power of ten.
+	bool is_truncated;
+	/// Last character of the number so far, '\0' before the first one.
+	char previous;
+	/// Offset of the first character of the number in the input.
+	uint64_t begin_offset;
+};
+
+/// Powers of ten up to the largest one that is exact as a double.
+constexpr double EXACT_POWERS_OF_TEN[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+										  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+constexpr auto MAX_EXACT_POWER_OF_TEN = int32_t{22};
+/// Largest mantissa that is exact as a double.
+constexpr auto MAX_EXACT_MANTISSA = uint64_t{1} << 53;
+
+constexpr auto MANTISSA_EXPLICIT_BITS = 52;
+constexpr auto MINIMUM_BINARY_EXPONENT = -1023;
+constexpr auto INFINITE_POWER = int32_t{0x7FF};
+/// Decimal exponents for which the product of a mantissa and a power of five can be exactly halfway between two
+/// doubles, which is rounded to even.
+constexpr auto MIN_EXPONENT_ROUND_TO_EVEN = int32_t{-4};
+constexpr auto MAX_EXPONENT_ROUND_TO_EVEN = int32_t{23};
+
+/// An unsigned 128 bit integer.
+struct Uint128 {
+	uint64_t high;
+	uint64_t low;
+};
+
+/// Multiply two 64 bit integers into their full 128 bit product, built from 32 bit halves.
+Uint128 multiply_full(const uint64_t lhs, const uint64_t rhs) {
+	constexpr auto LOW_MASK = uint64_t{0xFFFFFFFF};
+	const auto lhs_low = lhs & LOW_MASK;
+	const auto lhs_high = lhs >> 32;
+	const auto rhs_low = rhs & LOW_MASK;
+	const auto rhs_high = rhs >> 32;
+
+	const auto low_low = lhs_low * rhs_low;
+	const auto low_high = lhs_low * rhs_high;
+	const auto high_low = lhs_high * rhs_low;
+	const auto high_high = lhs_high * rhs_high;
+
+	const auto middle = high_low + (low_low >> 32) + (low_high & LOW_MASK);
+	return {high_high + (middle >> 32) + (low_high >> 32), (middle << 32) | (low_low & LOW_MASK)};
+}
+
+/// Number of leading zero bits of a non-zero value, found by halving the searched width in every step.
+int32_t leading_zero_count(uint64_t value) {
+	auto count = int32_t{0};
+	fpga_tools::UnrolledLoop<6>([&](auto step) {
+		constexpr auto width = 32 >> step;
+		if ((value >> (64 - width)) == 0) {
+			count += width;
+			value <<= width;
+		}
+	});
+	return count;
+}
+
+/**
+ * Round mantissa * 10^exponent to the nearest double, ties to even, with the Eisel-Lemire algorithm: the mantissa is
+ * multiplied with a 128 bit approximation of the power of five, which is always precise enough to round correctly
+ * (Mushtak and Lemire, "Fast number parsing without fallback").
+ * @param mantissa Decimal mantissa of at most 64 bits.
+ * @param exponent Decimal exponent.
+ * @return The bits of the positive double, saturated to zero or infinity.
+ */
+uint64_t eisel_lemire(uint64_t mantissa, const int32_t exponent) {
+	if (mantissa == 0 || exponent < SMALLEST_POWER_OF_TEN) {
+		return 0;
+	}
+	if (exponent > LARGEST_POWER_OF_TEN) {
+		return uint64_t{INFINITE_POWER} << MANTISSA_EXPLICIT_BITS;
+	}
+
+	const auto leading_zeros = leading_zero_count(mantissa);
+	mantissa <<= leading_zeros;
+
+	// Only the bits that end up in the result and the two bits that decide its rounding have to be exact.
+	const auto index = 2 * static_cast<size_t>(exponent - SMALLEST_POWER_OF_TEN);
+	auto product = multiply_full(mantissa, POWERS_OF_FIVE[index]);
+	constexpr auto PRECISION_MASK = ~uint64_t{0} >> (MANTISSA_EXPLICIT_BITS + 3);
+	if ((product.high & PRECISION_MASK) == PRECISION_MASK) {
+		const auto low_product = multiply_full(mantissa, POWERS_OF_FIVE[index + 1]);
+		product.low += low_product.high;
+		if (low_product.high > product.low) {
+			++product.high;
+		}
+	}
+
+	const auto upper_bit = static_cast<int32_t>(product.high >> 63);
+	const auto shift = upper_bit + 64 - MANTISSA_EXPLICIT_BITS - 3;
+	auto result_mantissa = product.high >> shift;
+	// floor(log2(10^exponent)) + 63, computed with a fixed point approximation of log2(10).
+	const auto power_of_two = (((152170 + 65536) * exponent) >> 16) + 63;
+	auto binary_exponent = power_of_two + upper_bit - leading_zeros - MINIMUM_BINARY_EXPONENT;
+
+	if (binary_exponent <= 0) {
+		// Subnormal, shift out the bits below the smallest exponent and round.
+		if (-binary_exponent + 1 >= 64) {
+			return 0;
+		}
+		result_mantissa >>= -binary_exponent + 1;
+		result_mantissa += result_mantissa & 1;
+		result_mantissa >>= 1;
+		// Rounding up may have made the number normal.
+		binary_exponent = result_mantissa < (uint64_t{1} << MANTISSA_EXPLICIT_BITS) ? 0 : 1;
+		return (result_mantissa & ~(uint64_t{1} << MANTISSA_EXPLICIT_BITS)) |
+			   (static_cast<uint64_t>(binary_exponent) << MANTISSA_EXPLICIT_BITS);
+	}
+
+	// Exactly halfway between two doubles, round to even instead of up.
+	if (product.low <= 1 && exponent >= MIN_EXPONENT_ROUND_TO_EVEN && exponent <= MAX_EXPONENT_ROUND_TO_EVEN &&
+		(result_mantissa & 3) == 1 && (result_mantissa << shift) == product.high) {
+		result_mantissa &= ~uint64_t{1};
+	}
+	result_mantissa += result_mantissa & 1;
+	result_mantissa >>= 1;
+	if (result_mantissa >= (uint64_t{2} << MANTISSA_EXPLICIT_BITS)) {
+		result_mantissa = uint64_t{1} << MANTISSA_EXPLICIT_BITS;
+		++binary_exponent;
+	}
+	result_mantissa &= ~(uint64_t{1} << MANTISSA_EXPLICIT_BITS);
+	if (binary_exponent >= INFINITE_POWER) {
+		return uint64_t{INFINITE_POWER} << MANTISSA_EXPLICIT_BITS;
+	}
+	return result_mantissa | (static_cast<uint64_t>(binary_exponent) << MANTISSA_EXPLICIT_BITS);
+}
+
+/**
+ * Round a decimal to the nearest double. Small exact mantissas with small exponents take Clinger's fast path, a single
+ * correctly rounded multiplication or division of exact doubles; everything else the Eisel-Lemire algorithm.
+ * @param mantissa Leading decimal digits of the number.
+ * @param exponent Decimal exponent of the mantissa.
+ * @param is_truncated Whether non-zero digits were dropped after the mantissa. The result is only exact if the
+ * mantissa and the mantissa plus one round to the same double.
+ * @param is_exact Set to whether the result is the correctly rounded value of the number.
+ * @return The positive double.
+ */
+double decimal_to_double(const uint64_t mantissa, const int32_t exponent, const bool is_truncated, bool &is_exact) {
+	is_exact = true;
+	if (!is_truncated && mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER_OF_TEN &&
+		exponent <= MAX_EXACT_POWER_OF_TEN) {
+		const auto value = static_cast<double>(mantissa);
+		return exponent < 0 ? value / EXACT_POWERS_OF_TEN[-exponent] : value * EXACT_POWERS_OF_TEN[exponent];
+	}
+
+	const auto bits = eisel_lemire(mantissa, exponent);
+	if (is_truncated) {
+		is_exact = eisel_lemire(mantissa + 1, exponent) == bits;
+	}
+	return sycl::bit_cast<double>(bits);
+}
+
+/**
+ * Feed a single number character into the partially parsed number.
+ * @param state Number to update.
+ * @param c Character, must be one for which is_number_char holds.
+ * @return Whether the character may follow the previous characters of the number in the JSON number grammar.
+ */
+bool consume_number_char(NumberState &state, const char c) {
+	const auto previous = state.previous;
+	const auto follows_digit = previous >= '0' && previous <= '9';
+	const auto follows_exponent_marker = previous == 'e' || previous == 'E';
+	state.previous = c;
+
+	auto is_allowed = true;
+	if (c >= '0' && c <= '9') {
+		const auto in_integer = !state.in_fraction && !state.in_exponent;
+		if (in_integer && state.has_leading_zero) {
+			is_allowed = false;
+		}
+		if (in_integer && c == '0' && !follows_digit) {
+			state.has_leading_zero = true;
+		}
+
+		const auto digit = static_cast<uint64_t>(c - '0');
+		if (state.in_exponent) {
+			if (state.explicit_exponent < MAX_EXPONENT) {
+				state.explicit_exponent = state.explicit_exponent * 10 + static_cast<int32_t>(digit);
+			}
+		} else if (state.digit_count < MAX_MANTISSA_DIGITS) {
+			state.mantissa = state.mantissa * 10 + digit;
+			// Leading zeros are not significant.
+			if (state.mantissa != 0) {
+				++state.digit_count;
+			}
+			if (state.in_fraction) {
+				--state.implied_exponent;
+			}
+		} else {
+			state.is_truncated |= digit != 0;
+			if (!state.in_fraction) {
+				// The integer is too large for the mantissa, drop the digit but keep its magnitude.
+				++state.implied_exponent;
+				state.is_float = true;
+			}
+		}
+	} else if (c == '-') {
+		is_allowed = previous == '\0' || follows_exponent_marker;
+		if (state.in_exponent) {
+			state.is_exponent_negative = true;
+		} else {
+			state.is_negative = true;
+		}
+	} else if (c == '+') {
+		is_allowed = follows_exponent_marker;
+	} else if (c == '.') {
+		is_allowed = follows_digit && !state.in_fraction && !state.in_exponent;
+		state.in_fraction = true;
+		state.is_float = true;
+	} else if (c == 'e' || c == 'E') {
+		is_allowed = follows_digit && !state.in_exponent;
+		state.in_exponent = true;
+		state.is_float = true;
+	}
+	return is_allowed;
+}
+
+/// Whether the number parsed so far is complete, i.e. does not end in a sign, decimal point or exponent marker.
+bool is_complete_number(const NumberState &state) { return state.previous >= '0' && state.previous <= '9'; }
+
+/// A completely parsed number waiting to be converted to its value.
+struct CompletedNumber {
+	uint64_t mantissa;
+	/// Decimal exponent of the mantissa, implied and explicit together.
+	int32_t exponent;
+	bool is_negative;
+	bool is_float;
+	bool is_truncated;
+	/// Offset of the first character of the number in the input.
+	uint64_t begin_offset;
+};
+
+/// Numbers completed within a single cache line, in input order.
+struct CompletedNumbers {
+	std::array<CompletedNumber, MAX_NUMBERS_PER_LINE> numbers;
+	uint8_t count;
+};
+
+// A number completes at the first byte after its run, so only the first byte of a line can complete one without a
+// number character in front of it in the same line, and the next number completes two bytes later at the earliest.
+// Together with the number flushed at the end of the input, the numbers of a line always fit into CompletedNumbers.
+static_assert(MAX_NUMBERS_PER_LINE >= CACHE_LINE_SIZE / 2 + 1, "Every number completed in a line needs a slot.");
+
+/// Take a completely parsed number out of the state it was parsed in.
+CompletedNumber complete_number(const NumberState &state) {
+	auto number = CompletedNumber{};
+	number.mantissa = state.mantissa;
+	number.exponent =
+		state.implied_exponent + (state.is_exponent_negative ? -state.explicit_exponent : state.explicit_exponent);
+	number.is_negative = state.is_negative;
+	number.is_float = state.is_float;
+	number.is_truncated = state.is_truncated;
+	number.begin_offset = state.begin_offset;
+	return number;
+}
+
+/**
+ * Convert a completed number and store it in the numbers of a cache line.
+ * Integers that do not fit into an int64_t are stored as floats. A float whose dropped digits decide its rounding is
+ * left to the host, see NumberCacheLine::needs_host_conversion.
+ * @param number Number to convert.
+ * @param index Index of the number in its line.
+ * @param numbers Numbers to store it in.
+ */
+void convert_number(const CompletedNumber &number, const size_t index, NumberCacheLine &numbers) {
+	constexpr auto MAX_POSITIVE = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+	const auto fits_integer =
+		number.is_negative ? number.mantissa <= MAX_POSITIVE + 1 : number.mantissa <= MAX_POSITIVE;
+
+	auto value = NumberValue{};
+	const auto is_float = number.is_float || !fits_integer;
+	auto needs_host_conversion = false;
+	if (is_float && number.mantissa == 0) {
+		value.floating_point = number.is_negative ? -0.0 : 0.0;
+	} else if (is_float) {
+		auto is_exact = true;
+		const auto magnitude = decimal_to_double(number.mantissa, number.exponent, number.is_truncated, is_exact);
+		value.floating_point = number.is_negative ? -magnitude : magnitude;
+		if (!is_exact) {
+			value.integer = static_cast<int64_t>(number.begin_offset);
+			needs_host_conversion = true;
+		}
+	} else {
+		value.integer = static_cast<int64_t>(number.is_negative ? ~number.mantissa + 1 : number.mantissa);
+	}
+
+	numbers.values[index] = value;
+	numbers.is_float[index] = is_float;
+	numbers.needs_host_conversion[index] = needs_host_conversion;
+}
+
+/**
+ * Convert up to NUMBER_CONVERTER_COUNT completed numbers of a line at once, so that the converters exist only that
+ * many times rather than once per byte.
+ * @param completed Numbers completed in the line.
+ * @param first_index Index of the first number to convert.
+ * @param numbers Numbers of the line to store the values in.
+ */
+void convert_numbers(const CompletedNumbers &completed, const size_t first_index, NumberCacheLine &numbers) {
+	fpga_tools::UnrolledLoop<NUMBER_CONVERTER_COUNT>([&](auto converter) {
+		const auto index = first_index + converter;
+		if (index < completed.count) {
+			convert_number(completed.numbers[index], index, numbers);
+		}
+	});
+}
+
+/**
+ * Find the numbers of a tokenized cache line and parse their digits, without converting them to their values yet.
+ * @param state Partially parsed number after the previous line, updated to the state after this line.
+ * @param tokenized_cacheline Line to parse.
+ * @param status Status the first malformed number is reported to, unless it already holds an error.
+ * @param line_offset Offset of the line in the input, used to locate errors.
+ * @param ends_document Whether the line ends the document, which completes a number still being parsed.
+ * @return The numbers completed in this line.
+ */
+CompletedNumbers find_numbers(NumberState &state, const TokenizedCacheLine &tokenized_cacheline, ParseStatus &status,
+							  const size_t line_offset, const bool ends_document) {
+	const auto &line = tokenized_cacheline.line;
+	const auto &is_number = tokenized_cacheline.bitmaps.is_number;
+
+	auto completed = CompletedNumbers{};
+	completed.count = 0;
+
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
+		const auto c = line[byte_index];
+		if (is_number[byte_index]) {
+			if (!state.in_run) {
+				state = NumberState{};
+				state.in_run = true;
+				state.begin_offset = line_offset + byte_index;
+				state.is_valid = c == '-' || (c >= '0' && c <= '9');
+				if (!state.is_valid) {
+					status.report(ErrorCode::InvalidNumber, line_offset + byte_index);
+				}
+			}
+			if (!consume_number_char(state, c) && state.is_valid) {
+				status.report(ErrorCode::InvalidNumber, line_offset + byte_index);
+			}
+		} else if (state.in_run) {
+			if (state.is_valid) {
+				if (!is_complete_number(state)) {
+					status.report(ErrorCode::InvalidNumber, line_offset + byte_index);
+				}
+				completed.numbers[completed.count++] = complete_number(state);
+			}
+			state.in_run = false;
+		}
+	});
+
+	if (ends_document && state.in_run && state.is_valid) {
+		if (!is_complete_number(state)) {
+			status.report(ErrorCode::InvalidNumber, line_offset + CACHE_LINE_SIZE);
+		}
+		completed.numbers[completed.count++] = complete_number(state);
+	}
+
+	return completed;
+}
+
+/**
+ * Parse the numbers of a tokenized cache line, see find_numbers(), and convert them to their values.
+ * @return The numbers completed in this line.
+ */
+NumberCacheLine parse_numbers(NumberState &state, const TokenizedCacheLine &tokenized_cacheline, ParseStatus &status,
+							  const size_t line_offset, const bool ends_document) {
+	const auto completed = find_numbers(state, tokenized_cacheline, status, line_offset, ends_document);
+	auto numbers = NumberCacheLine{};
+	numbers.count = completed.count;
+	for (auto first_index = size_t{0}; first_index < completed.count; first_index += NUMBER_CONVERTER_COUNT) {
+		convert_numbers(completed, first_index, numbers);
+	}
+	return numbers;
+}
+
+/**
+ * Parse all numbers by reading tokenized cache lines from the input pipe and writing the numbers completed in each
+ * line to the output pipe. Numbers may span multiple cache lines, a number at the very end of the input is completed
+ * with the last line.
+ * @tparam InPipes Input pipes to read from, one per lane.
+ * @tparam OutPipes Output pipes to write to, one per lane.
+ * @tparam LaneCount Number of consecutive lines handled per iteration.
+ * @param q Queue to use.
+ * @param cache_line_count Number of cache lines to expect, a multiple of LaneCount.
+ * @param status Shared allocation the first malformed number is reported to, unless it already holds an error.
+ * @param input_offset Offset of the first line in the input, used to locate errors.
+ * @param carried_state If given, the partially parsed number to start with, updated with the state after the last
+ * line. Used to continue a document across multiple launches.
+ * @param is_end_of_input Whether the last line ends the document, which completes a number still being parsed.
+ * @param dependencies Events to wait for before starting.
+ */
+template <typename Id, typename InPipes, typename OutPipes, size_t LaneCount>
+sycl::event submit_number_parser(sycl::queue &q, const size_t cache_line_count, ParseStatus *status,
+								 const size_t input_offset, NumberState *carried_state = nullptr,
+								 const bool is_end_of_input = true, const std::vector<sycl::event> &dependencies = {}) {
+	const auto number_parser_event = q.submit([&](auto &h) {
+		h.depends_on(dependencies);
+		h.template single_task<Id>([=]() {
+			auto state = carried_state != nullptr ? *carried_state : NumberState{};
+			auto local_status = ParseStatus{};
+
+			[[intel::initiation_interval(1)]] for (auto group_index = size_t{0}; group_index < cache_line_count;
+												   group_index += LaneCount) {
+				auto completed = std::array<CompletedNumbers, LaneCount>{};
+				auto max_count = uint8_t{0};
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					const auto line_index = group_index + lane;
+					const auto tokenized_cacheline = InPipes::template PipeAt<lane>::read();
+					const auto line_offset = input_offset + line_index * CACHE_LINE_SIZE;
+					const auto ends_document = is_end_of_input && line_index == cache_line_count - 1;
+					completed[lane] =
+						find_numbers(state, tokenized_cacheline, local_status, line_offset, ends_document);
+					if (completed[lane].count > max_count) {
+						max_count = completed[lane].count;
+					}
+				});
+
+				// Lines with more numbers than there are converters take an iteration for every NUMBER_CONVERTER_COUNT.
+				auto numbers = std::array<NumberCacheLine, LaneCount>{};
+				for (auto first_index = size_t{0}; first_index < max_count; first_index += NUMBER_CONVERTER_COUNT) {
+					fpga_tools::UnrolledLoop<LaneCount>(
+						[&](auto lane) { convert_numbers(completed[lane], first_index, numbers[lane]); });
+				}
+
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					numbers[lane].count = completed[lane].count;
+					OutPipes::template PipeAt<lane>::write(numbers[lane]);
+				});
+			}
+
+			if (carried_state != nullptr) {
+				*carried_state = state;
+			}
+			status->report(local_status.code, local_status.offset);
+		});
+	});
+
+	return number_parser_event;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Split [0, count) into consecutive ranges of about the same size and process each of them on a thread of its own.
+ * The first range is processed on the calling thread, which returns once all ranges are done.
+ * @param count Number of items to process.
+ * @param range_count Number of ranges, at least one.
+ * @param function Called as function(range_index, begin, end) for every range, in parallel.
+ */
+template <typename Function>
+void parallel_for_ranges(const size_t count, const size_t range_count, const Function &function) {
+	const auto range_size = (count + range_count - 1) / range_count;
+	auto threads = std::vector<std::thread>{};
+	threads.reserve(range_count - 1);
+	for (auto range_index = size_t{1}; range_index < range_count; ++range_index) {
+		const auto begin = std::min(range_index * range_size, count);
+		const auto end = std::min(begin + range_size, count);
+		threads.emplace_back([&function, range_index, begin, end]() { function(range_index, begin, end); });
+	}
+	function(size_t{0}, size_t{0}, std::min(range_size, count));
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "definitions.hpp"
+
+/// Human readable description of an error code.
+std::string to_string(const ErrorCode code) {
+	switch (code) {
+	case ErrorCode::None:
+		return "no error";
+	case ErrorCode::InvalidUtf8:
+		return "invalid UTF-8";
+	case ErrorCode::UnexpectedCharacter:
+		return "unexpected character";
+	case ErrorCode::InvalidEscape:
+		return "invalid escape sequence";
+	case ErrorCode::UnescapedControlCharacter:
+		return "unescaped control character in string";
+	case ErrorCode::UnclosedString:
+		return "unclosed string";
+	case ErrorCode::InvalidNumber:
+		return "invalid number";
+	case ErrorCode::UnexpectedToken:
+		return "unexpected token";
+	case ErrorCode::MismatchedBracket:
+		return "mismatched bracket";
+	case ErrorCode::UnclosedScope:
+		return "unclosed object or array";
+	case ErrorCode::EmptyDocument:
+		return "empty document";
+	case ErrorCode::DepthExceeded:
+		return "nesting too deep";
+	case ErrorCode::ScopeTooLarge:
+		return "object or array too large";
+	default:
+		return "unknown error";
+	}
+}
+
+/// Thrown when the input is not valid JSON.
+class ParseError : public std::runtime_error {
+  public:
+	explicit ParseError(const ParseStatus &status)
+		: std::runtime_error("JSON parse error: " + to_string(status.code) + " at byte " +
+							 std::to_string(status.offset) + "."),
+		  _status(status) {}
+
+	/**
+	 * An error in one of several documents parsed at once.
+	 * @param status Error, with the offset within the document.
+	 * @param document_index Index of the document.
+	 */
+	ParseError(const ParseStatus &status, const size_t document_index)
+		: std::runtime_error("JSON parse error: " + to_string(status.code) + " at byte " +
+							 std::to_string(status.offset) + " of document " + std::to_string(document_index) + "."),
+		  _status(status), _document_index(document_index) {}
+
+	ErrorCode code() const { return _status.code; }
+	/// Byte offset of the error in the input, or in its document if there is a document index.
+	size_t offset() const { return _status.offset; }
+	/// Index of the document the error is in, if several documents were parsed at once.
+	std::optional<size_t> document_index() const { return _document_index; }
+
+  private:
+	ParseStatus _status;
+	std::optional<size_t> _document_index;
+};
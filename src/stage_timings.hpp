@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <sycl/sycl.hpp>
+
+/// Time spent in every stage of a parse, to find the stage that bounds the throughput.
+struct StageTimings {
+	using Duration = std::chrono::nanoseconds;
+
+	/// Run time of every kernel, zero unless the queue was created with sycl::property::queue::enable_profiling and
+	/// the pipeline runs on the device. The host backend spends all of its time in collect.
+	Duration producer;
+	Duration utf8_validator;
+	Duration tokenizer;
+	Duration string_filter;
+	Duration number_parser;
+	Duration tape_builder;
+	/// From the start of the first kernel to the end of the last one.
+	Duration device;
+	/// Host copy of the input into memory the device can read.
+	Duration input_copy;
+	/// Host time spent collecting the output lines and the tape, including waiting for the device.
+	Duration collect;
+	/// Host time spent assembling the collected strings, numbers and nodes into the returned documents.
+	Duration finish;
+	/// Host time of the whole parse.
+	Duration total;
+
+	StageTimings &operator+=(const StageTimings &other) {
+		producer += other.producer;
+		utf8_validator += other.utf8_validator;
+		tokenizer += other.tokenizer;
+		string_filter += other.string_filter;
+		number_parser += other.number_parser;
+		tape_builder += other.tape_builder;
+		device += other.device;
+		input_copy += other.input_copy;
+		collect += other.collect;
+		finish += other.finish;
+		total += other.total;
+		return *this;
+	}
+};
+
+/// Run time of a completed kernel according to its profiling info.
+StageTimings::Duration kernel_duration(const sycl::event &event) {
+	const auto start = event.get_profiling_info<sycl::info::event_profiling::command_start>();
+	const auto end = event.get_profiling_info<sycl::info::event_profiling::command_end>();
+	return StageTimings::Duration{end - start};
+}
+
+/**
+ * Time from the start of the first to the end of the last of a set of completed kernels.
+ * @param events Events of the kernels, at least one.
+ */
+StageTimings::Duration device_duration(const std::initializer_list<sycl::event> events) {
+	auto start = std::numeric_limits<uint64_t>::max();
+	auto end = uint64_t{0};
+	for (const auto &event : events) {
+		start = std::min(start, event.get_profiling_info<sycl::info::event_profiling::command_start>());
+		end = std::max(end, event.get_profiling_info<sycl::info::event_profiling::command_end>());
+	}
+	return StageTimings::Duration{end - start};
+}
@@ -1,72 +1,123 @@
 #pragma once
 
-template <typename Id, typename InPipe, typename OutPipe>
-sycl::event submit_string_filter(sycl::queue &q, const size_t count) {
+#include "definitions.hpp"
+#include "escape_decoder.hpp"
+#include "unrolled_loop.hpp"
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#include <sycl/sycl.hpp>
+
+/// State of the string filter, carried across cache lines.
+struct StringFilterState {
+	/// Whether the last byte of the previous line was inside a string.
+	bool in_string;
+	EscapeState escape;
+};
+
+/**
+ * Extract and decode the characters of all strings of a tokenized cache line.
+ * @param state State after the previous line, updated to the state after this line.
+ * @param tokenized_cacheline Line to filter.
+ * @param status Status the first invalid string character is reported to, unless it already holds an error.
+ * @param line_offset Offset of the line in the input, used to locate errors.
+ * @return The decoded characters and the length of every string, together with the tokens of the line.
+ */
+OutputCacheLine filter_strings(StringFilterState &state, const TokenizedCacheLine &tokenized_cacheline,
+							   ParseStatus &status, const size_t line_offset) {
+	const auto &line = tokenized_cacheline.line;
+	const auto &bitmaps = tokenized_cacheline.bitmaps;
+
+	auto current_cacheline = StringLine{};
+	auto current_count = uint8_t{0};
+
+	auto strings = StringMetadata{};
+	strings.continues_string = state.in_string && bitmaps.is_string[0];
+	auto current_string_length = uint8_t{0};
+
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
+		const auto is_string = bitmaps.is_string[byte_index];
+		const auto starts_string = is_string && !state.in_string;
+		const auto ends_string = !is_string && state.in_string;
+
+		if (starts_string) {
+			current_string_length = 0;
+		}
+
+		auto decoded = DecodedChars{};
+		if (is_string) {
+			decoded = decode_string_char(state.escape, line[byte_index], bitmaps.is_escaped[byte_index]);
+		} else if (ends_string) {
+			decoded = finish_string(state.escape);
+		}
+		status.report(decoded.error, line_offset + byte_index);
+
+		fpga_tools::UnrolledLoop<MAX_DECODED_BYTES>([&](auto decoded_index) {
+			if (decoded_index < decoded.count && current_count < STRING_LINE_SIZE) {
+				current_cacheline[current_count++] = decoded.chars[decoded_index];
+				++current_string_length;
+			}
+		});
+
+		// A string from the previous line that ends right at the start of this one only needs a part here if it
+		// decoded to anything.
+		if (ends_string && (byte_index != 0 || current_string_length != 0)) {
+			if (byte_index == 0) {
+				strings.continues_string = true;
+			}
+			strings.push_length(current_string_length);
+		}
+
+		state.in_string = is_string;
+	});
+
+	if (state.in_string) {
+		strings.push_length(current_string_length);
+	}
+
+	return {current_cacheline, strings, tokenized_cacheline.tokens, tokenized_cacheline.token_starts};
+}
+
+/**
+ * Extract and decode the characters of all strings by reading tokenized cache lines from the input pipe and writing
+ * them, together with the tokens and the length of every string, to the output pipe.
+ * @tparam InPipes Input pipes to read from, one per lane.
+ * @tparam OutPipes Output pipes to write to, one per lane.
+ * @tparam LaneCount Number of consecutive lines handled per iteration.
+ * @param q Queue to use.
+ * @param count Number of cache lines to expect, a multiple of LaneCount.
+ * @param status Shared allocation the first invalid string character is reported to, unless it already holds an
+ * error.
+ * @param input_offset Offset of the first line in the input, used to locate errors.
+ * @param carried_state If given, the state to start with, updated with the state after the last line. Used to
+ * continue a document across multiple launches.
+ * @param is_end_of_input Whether the last line ends the input, so a string still open is unclosed.
+ * @param dependencies Events to wait for before starting.
+ */
+template <typename Id, typename InPipes, typename OutPipes, size_t LaneCount>
+sycl::event submit_string_filter(sycl::queue &q, const size_t count, ParseStatus *status, const size_t input_offset,
+								 StringFilterState *carried_state = nullptr, const bool is_end_of_input = true,
+								 const std::vector<sycl::event> &dependencies = {}) {
 	const auto string_filter_event = q.submit([&](auto &h) {
+		h.depends_on(dependencies);
 		h.template single_task<Id>([=]() {
-			for (auto index = size_t{0}; index < count; ++index) {
-				const auto tokenized_cacheline = InPipe::read();
-				const auto &line = tokenized_cacheline.line;
-				const auto &bitmaps = tokenized_cacheline.bitmaps;
-
-				auto current_cacheline = CacheLine{};
-				auto current_count = uint16_t{0};
-
-				auto string_lengths = CacheLine{};
-
-				// We use a cacheline to store the lengths of the strings in the input cacheline. The first element is
-				// the total number of strings, the last element indicates if there is a string overflow.
-				string_lengths[0] = 0;
-
-				for (auto byte_index = size_t{0}; byte_index < CACHE_LINE_SIZE; ++byte_index) {
-					auto started_string = bool{false};
-					auto current_string_length = uint16_t{0};
-
-					for (; byte_index < CACHE_LINE_SIZE && bitmaps.is_string[byte_index]; ++byte_index) {
-						started_string = true;
-						const auto c = line[byte_index];
-
-						// If the current character is escaped, append the corresponding character to the output.
-						if (bitmaps.is_escaped[byte_index]) {
-							if (c == '\"' || c == '\\') {
-								current_cacheline[current_count++] = c;
-								++current_string_length;
-							} else if (c == 'n') {
-								current_cacheline[current_count++] = '\n';
-								++current_string_length;
-							} else if (c == 't') {
-								current_cacheline[current_count++] = '\t';
-								++current_string_length;
-							} else {
-								// Error: invalid escape sequence.
-							}
-						} else if (c != '\"' && c != '\\') {
-							// If the current character is not escaped, append it to the output.s
-							current_cacheline[current_count++] = c;
-							++current_string_length;
-						}
-					}
-
-					if (started_string) {
-						string_lengths[0] += 1;
-						string_lengths[string_lengths[0]] = current_string_length;
-					}
-				}
-
-				if (bitmaps.is_string[CACHE_LINE_SIZE - 1]) {
-					string_lengths[CACHE_LINE_SIZE - 1] = 1;
-				} else {
-					string_lengths[CACHE_LINE_SIZE - 1] = 0;
-				}
-				if (bitmaps.is_string[0]) {
-					string_lengths[CACHE_LINE_SIZE - 2] = 1;
-				} else {
-					string_lengths[CACHE_LINE_SIZE - 2] = 0;
-				}
-
-				// Write the current cacheline to the output pipe.
-				OutPipe::write({current_cacheline, string_lengths, tokenized_cacheline.tokens});
+			auto state = carried_state != nullptr ? *carried_state : StringFilterState{};
+			auto local_status = ParseStatus{};
+
+			[[intel::initiation_interval(1)]] for (auto index = size_t{0}; index < count; index += LaneCount) {
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					const auto tokenized_cacheline = InPipes::template PipeAt<lane>::read();
+					OutPipes::template PipeAt<lane>::write(filter_strings(
+						state, tokenized_cacheline, local_status, input_offset + (index + lane) * CACHE_LINE_SIZE));
+				});
+			}
+
+			if (is_end_of_input && state.in_string) {
+				local_status.report(ErrorCode::UnclosedString, input_offset + count * CACHE_LINE_SIZE);
+			}
+
+			if (carried_state != nullptr) {
+				*carried_state = state;
 			}
+			status->report(local_status.code, local_status.offset);
 		});
 	});
 
@@ -1,76 +1,798 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#include <sycl/sycl.hpp>
+
 #include "definitions.hpp"
-#include "string_filter.hpp"
+#include "onchip_memory_with_cache.hpp"
+#include "parallel.hpp"
 #include "taped_json.hpp"
+#include "tokenizer.hpp"
+
+/// Deepest nesting of objects and arrays the tape builder supports, the same limit as simdjson's default.
+constexpr auto MAX_SCOPE_DEPTH = size_t{1024};
+/// Scopes kept in registers in front of the on-chip scope stack, so that a scope pushed by one token can be popped by
+/// the next one without waiting for the memory.
+constexpr auto SCOPE_STACK_CACHE_DEPTH = size_t{4};
+/// A launch patches at most the begin node of every scope open when it starts, the root of the document and a number
+/// that started in the previous launch.
+constexpr auto MAX_TAPE_PATCHES = MAX_SCOPE_DEPTH + 2;
+/// Lines after which the tape builder publishes its progress to the host, see TapeChunk::line_count.
+constexpr auto PROGRESS_INTERVAL = size_t{256};
+/// Lines and nodes the host TapeBuilder hands to a thread at least, below which starting one costs more than it saves.
+constexpr auto MIN_LINES_PER_THREAD = size_t{4096};
+constexpr auto MIN_NODES_PER_THREAD = size_t{1} << 16;
+
+/// What the structure validator of the tape builder accepts next.
+enum class Expectation : uint8_t {
+	/// The value of a new document.
+	RootValue,
+	/// Nothing but the end of the document, after its value.
+	DocumentEnd,
+	/// A value after a colon or after a comma in an array.
+	Value,
+	/// A value or ']' right after '['.
+	ValueOrArrayEnd,
+	/// A key or '}' right after '{'.
+	KeyOrObjectEnd,
+	/// A key after a comma in an object.
+	Key,
+	/// The colon after a key.
+	Colon,
+	/// A comma or the end of the innermost scope after a value.
+	CommaOrScopeEnd,
+};
+
+/// An open object or array.
+struct Scope {
+	/// Index of the begin node on the tape.
+	uint64_t begin_index;
+	/// Number of values in the scope so far, keys are not counted.
+	uint32_t value_count;
+	bool is_object;
+};
+
+/**
+ * State of the tape builder, carried across cache lines. Node, string and number indices count from the start of the
+ * input, while the payloads on the tape count from the start of their document.
+ */
+struct TapeBuilderState {
+	Expectation expectation;
+	/// Innermost open scope, only valid if depth is not zero.
+	Scope scope;
+	/// Number of open scopes.
+	uint32_t depth;
+	/// Whether an error was found, after which the tokens are only drained.
+	bool has_error;
+	uint64_t node_count;
+	uint64_t string_count;
+	uint64_t number_count;
+	/// Index of the root node of the current document, and of its first string and number.
+	uint64_t document_begin;
+	uint64_t document_string_begin;
+	uint64_t document_number_begin;
+	/// Whether the node of the last number waits for the number parser, which only knows if it is an integer or a
+	/// float once the number ends, possibly in a later line.
+	bool has_pending_number;
+	uint64_t pending_number_index;
+	uint64_t pending_number_payload;
+};
+
+/// State of the tape builder together with its scope stack, which does not outlive a launch on the device.
+struct CarriedTapeBuilderState {
+	TapeBuilderState state;
+	/// Scopes around the innermost one, outermost first.
+	std::array<Scope, MAX_SCOPE_DEPTH> stack;
+};
+
+/// A node that belongs to the tape of an earlier launch, e.g. the begin node of a scope that closes in a later chunk.
+struct TapePatch {
+	uint64_t index;
+	TapeNode node;
+};
+
+/// Tape written by a single launch of the tape builder into memory shared with the host.
+struct TapeChunk {
+	/// Nodes from the first node of this launch on, with room for max_tape_size() nodes.
+	TapeNode *nodes;
+	/// Nodes of earlier launches, with room for MAX_TAPE_PATCHES patches.
+	TapePatch *patches;
+	size_t node_count;
+	size_t patch_count;
+	/// Strings and numbers referenced by the nodes of this launch.
+	size_t string_count;
+	size_t number_count;
+	/// Output lines written so far, published every PROGRESS_INTERVAL lines while the kernel runs so the host can
+	/// collect them early. Must be accessed through a LineCountRef.
+	size_t line_count;
+};
+
+/// Atomic view of TapeChunk::line_count, shared by the device and the host while the kernel runs.
+using LineCountRef = sycl::atomic_ref<size_t, sycl::memory_order::relaxed, sycl::memory_scope::system,
+									  sycl::access::address_space::global_space>;
+
+/// Nodes written for some cache lines at most: every node but a root stands for a token, which needs a byte, and every
+/// root but the first one follows a document separator, which is a token without a node.
+constexpr size_t max_tape_size(const size_t cache_line_count) { return cache_line_count * CACHE_LINE_SIZE + 1; }
+
+/// Scope stack of the host, kept right in the carried state.
+struct CarriedScopeStack {
+	std::array<Scope, MAX_SCOPE_DEPTH> &scopes;
+
+	Scope read(const size_t index) const { return scopes[index]; }
+	void write(const size_t index, const Scope &scope) { scopes[index] = scope; }
+};
+
+/**
+ * Checks the tokens of consecutive output lines against the JSON grammar and writes their nodes into a TapeChunk.
+ * Holds no state of its own beyond a launch, so the device and the host can build the same tape line by line.
+ * @tparam ScopeStack Stack of the scopes around the innermost one, with read(depth) and write(depth, scope).
+ */
+template <typename ScopeStack> class TapeLineBuilder {
+  public:
+	/**
+	 * @param state State after the previous lines, updated with every line.
+	 * @param stack Scopes around the innermost one, outermost first.
+	 * @param status Status the first structural error is reported to, unless it already holds an error.
+	 * @param tape Tape of this launch, whose nodes and patches are written.
+	 * @param input_offset Offset of the first line of this launch in the input, used to locate errors.
+	 */
+	TapeLineBuilder(TapeBuilderState &state, ScopeStack &stack, ParseStatus &status, TapeChunk &tape,
+					const size_t input_offset)
+		: _state(state), _stack(stack), _status(status), _tape(tape), _input_offset(input_offset),
+		  _launch_begin(state.node_count), _launch_string_begin(state.string_count),
+		  _launch_number_begin(state.number_count) {}
+
+	/**
+	 * Add the tokens of a single line to the tape.
+	 * @param index Index of the line within this launch.
+	 * @param output Line with its strings and the numbers that end in it.
+	 */
+	void build_line(const size_t index, const OutputCacheLine &output) {
+		// A number that started in an earlier line is the first one to end in this line.
+		const auto &numbers = output.numbers;
+		auto number_index = size_t{0};
+		if (_state.has_pending_number && numbers.count > 0) {
+			const auto number_token = numbers.is_float[0] ? Token::FloatToken : Token::IntegerToken;
+			_write_node(_state.pending_number_index, TapedJson::make_node(number_token, _state.pending_number_payload));
+			_state.has_pending_number = false;
+			++number_index;
+		}
+
+		// Find where every token starts for all tokens of the line at once, which leaves only the grammar and the scope
+		// stack to the loop over the tokens, one token per iteration.
+		auto token_offsets = std::array<uint8_t, CACHE_LINE_SIZE>{};
+		auto token_count = size_t{0};
+		fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
+			if (output.token_starts[byte_index]) {
+				token_offsets[token_count++] = byte_index;
+			}
+		});
+
+		[[intel::initiation_interval(1)]] for (auto token_index = size_t{0};
+											   token_index < token_count && !_state.has_error; ++token_index) {
+			const auto token = static_cast<Token>(output.tokens[token_index]);
+			if (token == Token::EndOfTokens) {
+				break;
+			}
+
+			const auto error = _consume_token(token, numbers, number_index);
+			if (error != ErrorCode::None) {
+				_status.report(error, _input_offset + index * CACHE_LINE_SIZE + token_offsets[token_index]);
+				_state.has_error = true;
+			}
+		}
+	}
+
+	/**
+	 * Complete the launch and store the number of nodes, patches, strings and numbers it wrote in the tape.
+	 * @param cache_line_count Number of lines built in this launch.
+	 * @param is_end_of_input Whether the last line ends the input, which completes the last document.
+	 * @param allow_empty_document Whether the input may end with an empty document.
+	 */
+	void finish(const size_t cache_line_count, const bool is_end_of_input, const bool allow_empty_document) {
+		if (is_end_of_input && !_state.has_error) {
+			const auto end_offset = _input_offset + cache_line_count * CACHE_LINE_SIZE;
+			if (_state.depth != 0) {
+				_status.report(ErrorCode::UnclosedScope, end_offset);
+			} else if (_state.expectation != Expectation::RootValue) {
+				_finish_document();
+			} else if (!allow_empty_document) {
+				_status.report(ErrorCode::EmptyDocument, end_offset);
+			}
+		}
+
+		_tape.node_count = _state.node_count - _launch_begin;
+		_tape.patch_count = _patch_count;
+		_tape.string_count = _state.string_count - _launch_string_begin;
+		_tape.number_count = _state.number_count - _launch_number_begin;
+	}
+
+  private:
+	void _write_node(const uint64_t index, const TapeNode node) {
+		if (index >= _launch_begin) {
+			_tape.nodes[index - _launch_begin] = node;
+		} else {
+			_tape.patches[_patch_count++] = TapePatch{index, node};
+		}
+	}
+
+	void _push_node(const TapeNode node) { _write_node(_state.node_count++, node); }
+
+	void _finish_document() {
+		const auto document_size = _state.node_count - _state.document_begin;
+		_write_node(_state.document_begin, TapedJson::make_node(Token::StartOfTokens, document_size));
+	}
+
+	void _end_value() {
+		_state.expectation = _state.depth == 0 ? Expectation::DocumentEnd : Expectation::CommaOrScopeEnd;
+	}
+
+	/// Check the next token against the grammar, write its node and advance the expectation.
+	ErrorCode _consume_token(const Token token, const NumberCacheLine &numbers, size_t &number_index) {
+		auto &state = _state;
+		switch (token) {
+		case Token::DocumentEndToken:
+			if (state.depth != 0) {
+				return ErrorCode::UnclosedScope;
+			}
+			if (state.expectation != Expectation::RootValue) {
+				_finish_document();
+			}
+			state.expectation = Expectation::RootValue;
+			return ErrorCode::None;
+		case Token::ColonToken:
+			if (state.expectation != Expectation::Colon) {
+				return ErrorCode::UnexpectedToken;
+			}
+			state.expectation = Expectation::Value;
+			return ErrorCode::None;
+		case Token::CommaToken:
+			if (state.expectation != Expectation::CommaOrScopeEnd) {
+				return ErrorCode::UnexpectedToken;
+			}
+			state.expectation = state.scope.is_object ? Expectation::Key : Expectation::Value;
+			return ErrorCode::None;
+		case Token::ObjectEndToken:
+		case Token::ArrayEndToken: {
+			const auto is_object = token == Token::ObjectEndToken;
+			const auto empty_scope = is_object ? Expectation::KeyOrObjectEnd : Expectation::ValueOrArrayEnd;
+			if (state.expectation != Expectation::CommaOrScopeEnd && state.expectation != empty_scope) {
+				return ErrorCode::UnexpectedToken;
+			}
+			if (state.depth == 0 || state.scope.is_object != is_object) {
+				return ErrorCode::MismatchedBracket;
+			}
+			const auto begin_token = is_object ? Token::ObjectBeginToken : Token::ArrayBeginToken;
+			_push_node(TapedJson::make_node(token, state.scope.begin_index - state.document_begin));
+			const auto end_index = state.node_count - state.document_begin;
+			// The begin node only has room for TAPE_END_INDEX_BITS of the end index, more would wrap around.
+			if (end_index > TAPE_END_INDEX_MASK) {
+				return ErrorCode::ScopeTooLarge;
+			}
+			_write_node(state.scope.begin_index,
+						TapedJson::make_scope_begin_node(begin_token, end_index, state.scope.value_count));
+			if (--state.depth > 0) {
+				state.scope = _stack.read(state.depth - 1);
+			}
+			_end_value();
+			return ErrorCode::None;
+		}
+		case Token::StringToken:
+			if (state.expectation == Expectation::KeyOrObjectEnd || state.expectation == Expectation::Key) {
+				_push_node(TapedJson::make_node(token, state.string_count++ - state.document_string_begin));
+				state.expectation = Expectation::Colon;
+				return ErrorCode::None;
+			}
+			[[fallthrough]];
+		default:
+			if (state.expectation != Expectation::RootValue && state.expectation != Expectation::Value &&
+				state.expectation != Expectation::ValueOrArrayEnd) {
+				return ErrorCode::UnexpectedToken;
+			}
+			if (state.expectation == Expectation::RootValue) {
+				// The root node is written once the document ends.
+				state.document_begin = state.node_count++;
+				state.document_string_begin = state.string_count;
+				state.document_number_begin = state.number_count;
+			} else {
+				++state.scope.value_count;
+			}
 
-template <typename Id, typename OutPipe>
-std::pair<sycl::event, OutputCacheLine *> submit_consumer(sycl::queue &q, const size_t cache_line_count) {
+			if (token == Token::ObjectBeginToken || token == Token::ArrayBeginToken) {
+				if (state.depth == MAX_SCOPE_DEPTH) {
+					return ErrorCode::DepthExceeded;
+				}
+				if (state.depth > 0) {
+					_stack.write(state.depth - 1, state.scope);
+				}
+				++state.depth;
+				const auto is_object = token == Token::ObjectBeginToken;
+				// The begin node is written once the scope closes.
+				state.scope = Scope{state.node_count++, 0, is_object};
+				state.expectation = is_object ? Expectation::KeyOrObjectEnd : Expectation::ValueOrArrayEnd;
+				return ErrorCode::None;
+			}
 
-	OutputCacheLine *output_cache_lines;
-	if ((output_cache_lines = sycl::malloc_shared<OutputCacheLine>(cache_line_count, q)) == nullptr) {
-		std::cerr << "ERROR: could not allocate space for 'in'\n";
-		std::terminate();
+			if (token == Token::StringToken) {
+				_push_node(TapedJson::make_node(token, state.string_count++ - state.document_string_begin));
+			} else if (token == Token::NumberToken) {
+				const auto payload = state.number_count++ - state.document_number_begin;
+				if (number_index < numbers.count) {
+					const auto is_float = numbers.is_float[number_index++];
+					_push_node(TapedJson::make_node(is_float ? Token::FloatToken : Token::IntegerToken, payload));
+				} else {
+					state.has_pending_number = true;
+					state.pending_number_index = state.node_count++;
+					state.pending_number_payload = payload;
+				}
+			} else {
+				_push_node(TapedJson::make_node(token, 0));
+			}
+			_end_value();
+			return ErrorCode::None;
+		}
 	}
 
-	const auto consumer_event = q.submit([&](auto &h) {
+	TapeBuilderState &_state;
+	ScopeStack &_stack;
+	ParseStatus &_status;
+	TapeChunk &_tape;
+	size_t _input_offset;
+	/// Indices of the first node, string and number of this launch.
+	uint64_t _launch_begin;
+	uint64_t _launch_string_begin;
+	uint64_t _launch_number_begin;
+	size_t _patch_count = 0;
+};
+
+/**
+ * Build the tape on the device: drain the output pipes into memory shared with the host, check the tokens against the
+ * JSON grammar and write the tape. Brackets must match and values, keys, colons and commas must alternate as in
+ * RFC 8259. The begin node of every object and array is written once its scope closes, which takes an on-chip stack
+ * of the open scopes. Strings and numbers stay in the output lines, where the host TapeBuilder collects them, even
+ * while the kernel still runs.
+ * @tparam OutPipes Pipes of the string filter, one per lane.
+ * @tparam NumberPipes Pipes of the number parser, one per lane.
+ * @tparam LaneCount Number of consecutive lines read per iteration, which are reassembled in input order.
+ * @param q Queue to use.
+ * @param cache_line_count Number of cache lines to expect, a multiple of LaneCount.
+ * @param output_cache_lines Shared allocation with room for at least cache_line_count lines.
+ * @param tape Shared allocation to write the tape of this launch to. Its line_count must be zero.
+ * @param status Shared allocation the first structural error is reported to, unless it already holds an error.
+ * @param input_offset Offset of the first line in the input, used to locate errors.
+ * @param carried_state If given, the state to start with, updated with the state after the last line. Used to
+ * continue a document across multiple launches.
+ * @param is_end_of_input Whether the last line ends the input, which completes the last document.
+ * @param allow_empty_document Whether the input may end with an empty document, e.g. after the last line of NDJSON.
+ * @param dependencies Events to wait for before starting.
+ */
+template <typename Id, typename OutPipes, typename NumberPipes, size_t LaneCount>
+sycl::event submit_tape_builder(sycl::queue &q, const size_t cache_line_count, OutputCacheLine *output_cache_lines,
+								TapeChunk *tape, ParseStatus *status, const size_t input_offset,
+								CarriedTapeBuilderState *carried_state = nullptr, const bool is_end_of_input = true,
+								const bool allow_empty_document = false,
+								const std::vector<sycl::event> &dependencies = {}) {
+	const auto tape_builder_event = q.submit([&](auto &h) {
+		h.depends_on(dependencies);
 		h.template single_task<Id>([=]() {
-			for (auto index = size_t{0}; index < cache_line_count; ++index) {
-				const auto output = OutPipe::read();
-				output_cache_lines[index] = output;
+			auto state = carried_state != nullptr ? carried_state->state : TapeBuilderState{};
+			auto stack = fpga_tools::OnchipMemoryWithCache<Scope, MAX_SCOPE_DEPTH, SCOPE_STACK_CACHE_DEPTH>{};
+			if (carried_state != nullptr) {
+				for (auto depth = uint32_t{1}; depth < state.depth; ++depth) {
+					stack.write(depth - 1, carried_state->stack[depth - 1]);
+				}
+			}
+			auto local_status = ParseStatus{};
+			auto builder = TapeLineBuilder<decltype(stack)>{state, stack, local_status, *tape, input_offset};
+
+			auto line_count = LineCountRef{tape->line_count};
+			// Collect the lines into the tape, the lanes of an iteration in input order.
+			for (auto group_index = size_t{0}; group_index < cache_line_count; group_index += LaneCount) {
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					const auto index = group_index + lane;
+					auto output = OutPipes::template PipeAt<lane>::read();
+					output.numbers = NumberPipes::template PipeAt<lane>::read();
+					output_cache_lines[index] = output;
+					if ((index + 1) % PROGRESS_INTERVAL == 0) {
+						line_count.store(index + 1, sycl::memory_order::release);
+					}
+					builder.build_line(index, output);
+				});
+			}
+
+			builder.finish(cache_line_count, is_end_of_input, allow_empty_document);
+			line_count.store(cache_line_count, sycl::memory_order::release);
+			if (carried_state != nullptr) {
+				carried_state->state = state;
+				for (auto depth = uint32_t{1}; depth < state.depth; ++depth) {
+					carried_state->stack[depth - 1] = stack.read(depth - 1);
+				}
 			}
+			status->report(local_status.code, local_status.offset);
 		});
 	});
 
-	return {consumer_event, output_cache_lines};
+	return tape_builder_event;
 }
 
-TapedJson build_tape(const size_t cache_line_count, const OutputCacheLine *output_cache_lines) {
-	auto strings = std::vector<std::string>{};
-	auto tape = std::vector<Token>{};
-	auto had_overflow = false;
-	for (auto index = size_t{0}; index < cache_line_count; ++index) {
-		const auto &chars = output_cache_lines[index].line;
-		const auto &lengths = output_cache_lines[index].string_lengths;
-
-		const auto string_count = lengths[0];
-		auto char_index = size_t{0};
-
-		auto string_index = size_t{0};
-		if (had_overflow && lengths[CACHE_LINE_SIZE - 2] == 1) {
-			const auto string_length = lengths[++string_index];
-			// std::cout << "before: " << strings.back();
-			strings.back().append(chars.begin(), chars.begin() + string_length);
-			// std::cout << " after: " << strings.back() << std::endl;
-			char_index += string_length;
+/**
+ * Read a JSON number as the nearest double, independent of the locale. Magnitudes beyond the range of a double
+ * saturate to infinity or zero, like the device does.
+ * @param text The characters of the number, which follows the JSON number grammar.
+ */
+double read_float(const std::string_view text) {
+	auto value = 0.0;
+	const auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (result.ec != std::errc::result_out_of_range) {
+		return value;
+	}
+
+	// Out of range, so whether it over- or underflows only depends on the exponent of the first significant digit.
+	const auto is_negative = text.front() == '-';
+	const auto exponent_begin = text.find_first_of("eE");
+	const auto digits = text.substr(is_negative ? 1 : 0, exponent_begin - (is_negative ? 1 : 0));
+	const auto point = std::min(digits.find('.'), digits.size());
+	const auto first_significant = digits.find_first_not_of("0.");
+	auto exponent = first_significant < point ? static_cast<int64_t>(point - first_significant) - 1
+											  : static_cast<int64_t>(point) - static_cast<int64_t>(first_significant);
+	if (exponent_begin != std::string_view::npos) {
+		auto explicit_begin = text.data() + exponent_begin + 1;
+		if (*explicit_begin == '+') {
+			++explicit_begin;
 		}
+		auto explicit_exponent = int64_t{0};
+		if (std::from_chars(explicit_begin, text.data() + text.size(), explicit_exponent).ec != std::errc{}) {
+			// Beyond an int64_t, which outweighs the digits of any number in memory.
+			const auto limit = int64_t{std::numeric_limits<int32_t>::max()};
+			explicit_exponent = *explicit_begin == '-' ? -limit : limit;
+		}
+		exponent += explicit_exponent;
+	}
+	const auto magnitude = exponent >= 0 ? std::numeric_limits<double>::infinity() : 0.0;
+	return is_negative ? -magnitude : magnitude;
+}
 
-		for (; string_index < string_count; ++string_index) {
-			const auto string_length = lengths[string_index + 1];
-			strings.emplace_back(std::string{chars.begin() + char_index, chars.begin() + char_index + string_length});
-			char_index += string_length;
+/**
+ * Collects the tape built on the device together with the strings and numbers of the output cache lines on the host.
+ * Lines can be appended in any number of batches, e.g. as soon as the device published them; a string that continues
+ * across lines is carried over from one batch to the next.
+ *
+ * Large batches and the split into documents can be spread over several threads: every thread first counts what its
+ * range of lines or documents holds, a prefix sum over the counts tells every thread where its part goes, and then all
+ * of them copy their part at once. The result is the same for any number of threads.
+ */
+class TapeBuilder {
+  public:
+	/// @param thread_count Threads to collect with at most, one to collect on the calling thread only.
+	explicit TapeBuilder(const size_t thread_count = 1) : _thread_count(std::max(thread_count, size_t{1})) {}
+
+	/**
+	 * Append the next lines of the output stream and the tape the device built from them.
+	 * @param cache_line_count Number of lines to append.
+	 * @param output_cache_lines Lines written by the tape builder kernel.
+	 * @param tape Tape written by the same launch of the tape builder kernel.
+	 */
+	void append(const size_t cache_line_count, const OutputCacheLine *output_cache_lines, const TapeChunk &tape) {
+		append_lines(cache_line_count, output_cache_lines);
+		append_tape(tape);
+	}
+
+	/**
+	 * Set the input the next lines were parsed from, which floats the device could not round are converted from. The
+	 * chunks of a stream must be set in order, each before the lines that end in it are appended; the number
+	 * characters at the end of a chunk are kept, so a float may start in the chunk before.
+	 * @param input Characters of the input, must stay valid until the next call.
+	 * @param input_size Number of characters.
+	 * @param input_offset Offset of the first character in the whole input.
+	 */
+	void set_input(const char *input, const size_t input_size, const size_t input_offset) {
+		_carried_number_text = std::move(_next_carried_number_text);
+		_carried_number_offset = _next_carried_number_offset;
+
+		auto number_begin = input_size;
+		while (number_begin > 0 && is_number_char(input[number_begin - 1])) {
+			--number_begin;
 		}
+		_next_carried_number_offset = input_offset + number_begin;
+		_next_carried_number_text.clear();
+		if (number_begin == 0 && _carried_number_offset + _carried_number_text.size() == input_offset) {
+			// The whole chunk continues the number of the chunk before.
+			_next_carried_number_text = _carried_number_text;
+			_next_carried_number_offset = _carried_number_offset;
+		}
+		_next_carried_number_text.append(input + number_begin, input_size - number_begin);
 
-		if (lengths[CACHE_LINE_SIZE - 1] == 1) {
-			had_overflow = true;
-		} else {
-			had_overflow = false;
+		_input = input;
+		_input_size = input_size;
+		_input_offset = input_offset;
+	}
+
+	/**
+	 * Collect the strings and numbers of the next lines of the output stream.
+	 * @param cache_line_count Number of lines to append.
+	 * @param output_cache_lines Lines written by the tape builder kernel.
+	 */
+	void append_lines(const size_t cache_line_count, const OutputCacheLine *output_cache_lines) {
+		const auto thread_count = std::min(_thread_count, cache_line_count / MIN_LINES_PER_THREAD);
+		if (thread_count > 1) {
+			_append_lines_in_parallel(cache_line_count, output_cache_lines, thread_count);
+			return;
 		}
 
-		// Get the output from the tokenizer.
-		const auto &tokens = output_cache_lines[index].tokens;
-		for (auto token_index = size_t{0}; token_index < CACHE_LINE_SIZE; ++token_index) {
-			const auto token = static_cast<Token>(tokens[token_index]);
+		_strings.reserve_additional(cache_line_count * CACHE_LINE_SIZE, cache_line_count * MAX_STRINGS_PER_LINE);
 
-			if (token == Token::EndOfTokens) {
-				break;
+		for (auto index = size_t{0}; index < cache_line_count; ++index) {
+			const auto &chars = output_cache_lines[index].line;
+			const auto &strings = output_cache_lines[index].strings;
+
+			auto char_index = size_t{0};
+
+			auto string_index = size_t{0};
+			if (strings.continues_string) {
+				const auto string_length = strings.length(string_index++);
+				_strings.extend_last_string(chars.data(), string_length);
+				char_index += string_length;
 			}
 
-			tape.push_back(token);
+			for (; string_index < strings.count; ++string_index) {
+				const auto string_length = strings.length(string_index);
+				_strings.append_string(chars.data() + char_index, string_length);
+				char_index += string_length;
+			}
+
+			const auto &line_numbers = output_cache_lines[index].numbers;
+			for (auto number_index = size_t{0}; number_index < line_numbers.count; ++number_index) {
+				_numbers.push_back(_convert_number(line_numbers, number_index));
+			}
+		}
+	}
+
+	/**
+	 * Append the tape of a launch of the tape builder kernel once it finished.
+	 * @param tape Tape written by the launch, which must follow the launches appended so far.
+	 */
+	void append_tape(const TapeChunk &tape) {
+		_tape.insert(_tape.end(), tape.nodes, tape.nodes + tape.node_count);
+		for (auto index = size_t{0}; index < tape.patch_count; ++index) {
+			_tape[tape.patches[index].index] = tape.patches[index].node;
 		}
+		_string_count += tape.string_count;
+		_number_count += tape.number_count;
+	}
+
+	/// Take the tape of the single document appended so far. Must be called at most once and only if the device
+	/// reported no error.
+	TapedJson finish() {
+		_check_counts();
+		return TapedJson{std::move(_tape), std::move(_strings), std::move(_numbers)};
 	}
 
-	const auto taped_json = TapedJson{std::move(tape), std::move(strings)};
+	/**
+	 * Split the tape at the root of every document, which points right after the last node of its document. Must be
+	 * called at most once and only if the device reported no error.
+	 */
+	std::vector<TapedJson> finish_documents() {
+		_check_counts();
+
+		auto document_begins = std::vector<size_t>{};
+		for (auto document_begin = size_t{0}; document_begin < _tape.size();
+			 document_begin += TapedJson::payload_of(_tape[document_begin])) {
+			document_begins.push_back(document_begin);
+		}
+		const auto document_count = document_begins.size();
+		document_begins.push_back(_tape.size());
+		if (document_count == 0) {
+			return {};
+		}
+		const auto thread_count =
+			std::clamp(std::min(_thread_count, _tape.size() / MIN_NODES_PER_THREAD), size_t{1}, document_count);
+
+		// The strings and numbers of a document follow those of the documents before it.
+		auto string_begins = std::vector<size_t>(document_count + 1);
+		auto number_begins = std::vector<size_t>(document_count + 1);
+		const auto count_documents = [&](size_t, const size_t begin, const size_t end) {
+			for (auto document_index = begin; document_index < end; ++document_index) {
+				auto string_count = size_t{0};
+				auto number_count = size_t{0};
+				for (auto index = document_begins[document_index]; index < document_begins[document_index + 1];
+					 ++index) {
+					switch (TapedJson::token_of(_tape[index])) {
+					case Token::StringToken:
+						++string_count;
+						break;
+					case Token::IntegerToken:
+					case Token::FloatToken:
+						++number_count;
+						break;
+					default:
+						break;
+					}
+				}
+				string_begins[document_index + 1] = string_count;
+				number_begins[document_index + 1] = number_count;
+			}
+		};
+		parallel_for_ranges(document_count, thread_count, count_documents);
+		std::partial_sum(string_begins.begin(), string_begins.end(), string_begins.begin());
+		std::partial_sum(number_begins.begin(), number_begins.end(), number_begins.begin());
+
+		auto parts = std::vector<std::optional<TapedJson>>(document_count);
+		const auto copy_documents = [&](size_t, const size_t begin, const size_t end) {
+			for (auto document_index = begin; document_index < end; ++document_index) {
+				const auto string_begin = string_begins[document_index];
+				parts[document_index].emplace(
+					std::vector<TapeNode>{_tape.begin() + document_begins[document_index],
+										  _tape.begin() + document_begins[document_index + 1]},
+					_strings.slice(string_begin, string_begins[document_index + 1] - string_begin),
+					std::vector<NumberValue>{_numbers.begin() + number_begins[document_index],
+											 _numbers.begin() + number_begins[document_index + 1]});
+			}
+		};
+		parallel_for_ranges(document_count, thread_count, copy_documents);
+
+		auto documents = std::vector<TapedJson>{};
+		documents.reserve(document_count);
+		for (auto &part : parts) {
+			documents.push_back(std::move(*part));
+		}
+		return documents;
+	}
+
+  private:
+	/**
+	 * Collect the strings and numbers of lines split into one range per thread. Every range is counted first, so the
+	 * prefix sums of the counts tell the threads where to copy their strings and numbers to.
+	 */
+	void _append_lines_in_parallel(const size_t cache_line_count, const OutputCacheLine *output_cache_lines,
+								   const size_t thread_count) {
+		struct RangeCounts {
+			size_t chars;
+			/// Strings that start in the range, the continuation of a string from the line before is not one.
+			size_t strings;
+			size_t numbers;
+		};
+
+		// The counts of range i end up at index i + 1, so the prefix sum starts every range at its own index.
+		auto counts = std::vector<RangeCounts>(thread_count + 1);
+		const auto count_range = [&](const size_t range_index, const size_t begin, const size_t end) {
+			auto &range_counts = counts[range_index + 1];
+			for (auto index = begin; index < end; ++index) {
+				const auto &strings = output_cache_lines[index].strings;
+				for (auto string_index = size_t{0}; string_index < strings.count; ++string_index) {
+					range_counts.chars += strings.length(string_index);
+				}
+				range_counts.strings += strings.count - (strings.continues_string ? 1 : 0);
+				range_counts.numbers += output_cache_lines[index].numbers.count;
+			}
+		};
+		parallel_for_ranges(cache_line_count, thread_count, count_range);
+		for (auto range_index = size_t{1}; range_index <= thread_count; ++range_index) {
+			counts[range_index].chars += counts[range_index - 1].chars;
+			counts[range_index].strings += counts[range_index - 1].strings;
+			counts[range_index].numbers += counts[range_index - 1].numbers;
+		}
+
+		const auto char_begin = _strings.total_length();
+		const auto appended = _strings.append_uninitialized(counts.back().chars, counts.back().strings);
+		const auto number_begin = _numbers.size();
+		_numbers.resize(number_begin + counts.back().numbers);
+
+		const auto copy_range = [&](const size_t range_index, const size_t begin, const size_t end) {
+			auto char_index = counts[range_index].chars;
+			auto string_index = counts[range_index].strings;
+			auto number_index = number_begin + counts[range_index].numbers;
+			for (auto index = begin; index < end; ++index) {
+				_copy_line(output_cache_lines[index], char_begin, appended.first, appended.second, char_index,
+						   string_index, number_index);
+			}
+		};
+		parallel_for_ranges(cache_line_count, thread_count, copy_range);
+	}
+
+	/**
+	 * Copy the strings and numbers of a single line to where the prefix sums of _append_lines_in_parallel() put them.
+	 * @param char_begin Offset of the first character appended by this batch among all strings.
+	 * @param chars Characters of this batch.
+	 * @param offsets Offsets of the strings started by this batch.
+	 * @param char_index Index of the next character within this batch, advanced.
+	 * @param string_index Index of the next string started within this batch, advanced.
+	 * @param number_index Index of the next number among all numbers, advanced.
+	 */
+	void _copy_line(const OutputCacheLine &output, const size_t char_begin, char *chars, size_t *offsets,
+					size_t &char_index, size_t &string_index, size_t &number_index) {
+		const auto &strings = output.strings;
+		auto line_char_index = size_t{0};
+		for (auto index = size_t{0}; index < strings.count; ++index) {
+			if (index != 0 || !strings.continues_string) {
+				offsets[string_index++] = char_begin + char_index;
+			}
+			const auto string_length = strings.length(index);
+			std::copy_n(output.line.data() + line_char_index, string_length, chars + char_index);
+			line_char_index += string_length;
+			char_index += string_length;
+		}
+
+		const auto &numbers = output.numbers;
+		for (auto index = size_t{0}; index < numbers.count; ++index) {
+			_numbers[number_index++] = _convert_number(numbers, index);
+		}
+	}
+
+	/**
+	 * Take a number of a line, converting a float the device could not round from the input.
+	 * @param numbers Numbers of the line.
+	 * @param index Index of the number within the line.
+	 */
+	NumberValue _convert_number(const NumberCacheLine &numbers, const size_t index) const {
+		if (!numbers.needs_host_conversion[index]) {
+			return numbers.values[index];
+		}
+		if (_input == nullptr) {
+			throw std::runtime_error("No input set to convert the float at " +
+									 std::to_string(numbers.values[index].integer) + " from.");
+		}
+
+		// The float either lies in the input or starts in the number characters carried over from the chunk before,
+		// which is rare enough to join them.
+		const auto offset = static_cast<size_t>(numbers.values[index].integer);
+		auto number = NumberValue{};
+		if (offset >= _input_offset) {
+			const auto begin = offset - _input_offset;
+			number.floating_point = read_float({_input + begin, _number_end(begin) - begin});
+		} else {
+			auto text = _carried_number_text.substr(offset - _carried_number_offset);
+			text.append(_input, _number_end(0));
+			number.floating_point = read_float(text);
+		}
+		return number;
+	}
+
+	/// Index of the first byte of the input from an index on that does not belong to a number.
+	size_t _number_end(size_t index) const {
+		while (index < _input_size && is_number_char(_input[index])) {
+			++index;
+		}
+		return index;
+	}
+
+	/// Make sure the tape refers to exactly the strings and numbers collected from the lines.
+	void _check_counts() const {
+		if (_string_count != _strings.size()) {
+			throw std::runtime_error("String count missmatch: " + std::to_string(_string_count) +
+									 " string tokens vs " + std::to_string(_strings.size()) + " strings.");
+		}
+		if (_number_count != _numbers.size()) {
+			throw std::runtime_error("Number count missmatch: " + std::to_string(_number_count) +
+									 " number tokens vs " + std::to_string(_numbers.size()) + " numbers.");
+		}
+	}
 
-	return taped_json;
-}
\ No newline at end of file
+	size_t _thread_count;
+	/// Input set with set_input().
+	const char *_input = nullptr;
+	size_t _input_size = 0;
+	size_t _input_offset = 0;
+	/// Number characters at the end of the chunks before the input, and where they start in the whole input.
+	std::string _carried_number_text;
+	size_t _carried_number_offset = 0;
+	/// The same for the chunk after the input.
+	std::string _next_carried_number_text;
+	size_t _next_carried_number_offset = 0;
+	StringArena _strings;
+	std::vector<NumberValue> _numbers;
+	std::vector<TapeNode> _tape;
+	/// Strings and numbers referenced by the tape.
+	size_t _string_count = 0;
+	size_t _number_count = 0;
+};
@@ -1,169 +1,337 @@
 #pragma once
 
+#include <algorithm>
 #include <iostream>
-#include <regex>
-#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "definitions.hpp"
+#include "json_writer.hpp"
 
-union JsonValue {
-	static_assert(sizeof(int64_t) == sizeof(double), "int64_t and double must be the same size");
-
-	struct {
-		size_t end_index;
-		size_t saturation;
-	} object_begin;
-	size_t object_index;
-	size_t string_index;
-	int64_t integer;
-	double floating_point;
+/// A node on the tape: the token in the upper 8 bits and its payload in the lower 56 bits.
+using TapeNode = uint64_t;
+
+constexpr auto TAPE_PAYLOAD_BITS = 56;
+constexpr auto TAPE_PAYLOAD_MASK = (TapeNode{1} << TAPE_PAYLOAD_BITS) - 1;
+/// Scope begin nodes store the index after the scope in the lower bits and the element count above it.
+constexpr auto TAPE_END_INDEX_BITS = 32;
+constexpr auto TAPE_END_INDEX_MASK = (TapeNode{1} << TAPE_END_INDEX_BITS) - 1;
+/// Element counts of larger scopes saturate at this value.
+constexpr auto MAX_SATURATION = (TapeNode{1} << (TAPE_PAYLOAD_BITS - TAPE_END_INDEX_BITS)) - 1;
+
+/**
+ * All strings of a document stored back to back in a single buffer, similar to simdjson's string buffer. String i
+ * spans from its offset to the offset of string i + 1, or to the end of the buffer for the last string.
+ */
+class StringArena {
+  public:
+	size_t size() const { return _offsets.size(); }
+	bool empty() const { return _offsets.empty(); }
+	/// Sum of the lengths of all strings.
+	size_t total_length() const { return _chars.size(); }
+	/// All strings concatenated.
+	std::string_view chars() const { return _chars; }
+
+	std::string_view operator[](const size_t index) const {
+		const auto begin = _offsets[index];
+		const auto end = index + 1 < _offsets.size() ? _offsets[index + 1] : _chars.size();
+		return std::string_view{_chars}.substr(begin, end - begin);
+	}
+
+	/**
+	 * Make room for more strings, growing geometrically so that repeated calls allocate O(log n) times.
+	 * @param additional_chars Number of characters about to be appended.
+	 * @param additional_strings Number of strings about to be started.
+	 */
+	void reserve_additional(const size_t additional_chars, const size_t additional_strings) {
+		_reserve_geometric(_chars, _chars.size() + additional_chars);
+		_reserve_geometric(_offsets, _offsets.size() + additional_strings);
+	}
+
+	/// Start a new string with the given characters.
+	void append_string(const char *begin, const size_t length) {
+		_offsets.push_back(_chars.size());
+		_chars.append(begin, length);
+	}
+
+	/// Append characters to the last string, e.g. its continuation in the next cache line.
+	void extend_last_string(const char *begin, const size_t length) { _chars.append(begin, length); }
+
+	/**
+	 * Append room for strings that are filled in afterwards, e.g. by several threads at once.
+	 * @param additional_chars Number of characters to append.
+	 * @param additional_strings Number of strings to start.
+	 * @return Where the characters go, and where the offsets of the started strings go. Offsets count from the first
+	 * character of all strings, characters appended to the last string do not start a new one.
+	 */
+	std::pair<char *, size_t *> append_uninitialized(const size_t additional_chars, const size_t additional_strings) {
+		const auto char_begin = _chars.size();
+		const auto string_begin = _offsets.size();
+		_chars.resize(char_begin + additional_chars);
+		_offsets.resize(string_begin + additional_strings);
+		return {_chars.data() + char_begin, _offsets.data() + string_begin};
+	}
+
+	/**
+	 * Copy a range of strings into a new arena.
+	 * @param first Index of the first string to copy.
+	 * @param count Number of strings to copy.
+	 */
+	StringArena slice(const size_t first, const size_t count) const {
+		auto arena = StringArena{};
+		if (count == 0) {
+			return arena;
+		}
+		const auto chars_begin = _offsets[first];
+		const auto chars_end = first + count < _offsets.size() ? _offsets[first + count] : _chars.size();
+		arena._chars.assign(_chars, chars_begin, chars_end - chars_begin);
+		arena._offsets.reserve(count);
+		for (auto index = first; index < first + count; ++index) {
+			arena._offsets.push_back(_offsets[index] - chars_begin);
+		}
+		return arena;
+	}
+
+  private:
+	template <typename Container> static void _reserve_geometric(Container &container, const size_t required) {
+		if (container.capacity() < required) {
+			container.reserve(std::max(required, 2 * container.capacity()));
+		}
+	}
+
+	std::string _chars;
+	std::vector<size_t> _offsets;
+};
+
+/// How TapedJson writes itself as JSON text.
+enum class JsonFormat : uint8_t {
+	/// Without any whitespace.
+	Minified,
+	/// One value or key per line, indented by the depth of its scope.
+	Pretty,
 };
 
+/**
+ * A parsed JSON document as a flat tape of 64 bit nodes, following the layout of simdjson's tape. The payload of a node
+ * depends on its token:
+ * - StartOfTokens: index right after the last node.
+ * - ObjectBeginToken, ArrayBeginToken: index of the first node after the scope and the saturated element count.
+ * - ObjectEndToken, ArrayEndToken: index of the matching begin node.
+ * - StringToken: index into the strings.
+ * - IntegerToken, FloatToken: index into the numbers.
+ * - TrueToken, FalseToken, NullToken: unused.
+ */
 class TapedJson {
   public:
 	TapedJson() = delete;
-	TapedJson(std::vector<Token> &&tokens, std::vector<std::string> &&strings)
-		: _strings(std::move(strings)) {
-		_construct_tape(std::move(tokens));
-	}
+	TapedJson(std::vector<TapeNode> &&tape, StringArena &&strings, std::vector<NumberValue> &&numbers)
+		: _tape(std::move(tape)), _strings(std::move(strings)), _numbers(std::move(numbers)) {}
 
-	void print_strings() const {
-		for (const auto &s : _strings) {
-			std::cout << "+++" << s << "+++" << std::endl;
+	void print_strings(std::ostream &os = std::cout) const {
+		auto writer = BufferedWriter{os};
+		for (auto index = size_t{0}; index < _strings.size(); ++index) {
+			writer.write("+++");
+			writer.write(_strings[index]);
+			writer.write("+++\n");
 		}
 	}
 
-	void print_tape() const {
-		for (size_t i = 0; i < _tape.size(); ++i) {
-			std::cout << i << " : ";
-			_print_token(std::cout, _tape[i]);
-			std::cout << std::endl;
+	/// Write one line per node of the tape, for debugging.
+	void print_tape(std::ostream &os = std::cout) const {
+		auto writer = BufferedWriter{os};
+		for (auto index = size_t{0}; index < _tape.size(); ++index) {
+			writer.write_integer(index);
+			writer.write(" : ");
+			_write_token(writer, _tape[index]);
+			writer.put('\n');
 		}
 	}
 
-	// private:
-	void _construct_tape(std::vector<Token> &&tokens) {
-		_tape.reserve(tokens.size() + 1);
-		_tape.push_back({Token::StartOfTokens, {.object_index = 0}});
-
-		auto string_index = size_t{0};
+	/**
+	 * Write the document as JSON text that parses back into the same tape.
+	 * @param os Stream to write to.
+	 * @param format Whether to write whitespace between the tokens.
+	 * @param indent_width Spaces per level of nesting in JsonFormat::Pretty.
+	 */
+	void write_json(std::ostream &os, const JsonFormat format = JsonFormat::Minified,
+					const size_t indent_width = 2) const {
+		// The scopes around the current node, to place the commas, colons and line breaks between their elements.
+		struct OpenScope {
+			bool is_object;
+			bool is_empty;
+			/// In an object, whether the next element is the value of the last key.
+			bool expects_value;
+		};
 
-		auto object_begin_indices = std::vector<size_t>{};
-		auto object_sizes = std::vector<size_t>{0};
+		auto writer = BufferedWriter{os};
+		const auto is_pretty = format == JsonFormat::Pretty;
+		auto scopes = std::vector<OpenScope>{};
+		for (auto index = size_t{1}; index < _tape.size(); ++index) {
+			const auto node = _tape[index];
+			const auto token = token_of(node);
+			if (!scopes.empty()) {
+				auto &scope = scopes.back();
+				if (token == Token::ObjectEndToken || token == Token::ArrayEndToken) {
+					if (is_pretty && !scope.is_empty) {
+						writer.put('\n');
+						writer.write_repeated(' ', (scopes.size() - 1) * indent_width);
+					}
+				} else if (scope.expects_value) {
+					writer.write(is_pretty ? ": " : ":");
+					scope.expects_value = false;
+				} else {
+					if (!scope.is_empty) {
+						writer.put(',');
+					}
+					if (is_pretty) {
+						writer.put('\n');
+						writer.write_repeated(' ', scopes.size() * indent_width);
+					}
+					scope.is_empty = false;
+					scope.expects_value = scope.is_object;
+				}
+			}
 
-		for (const auto token : tokens) {
-			object_sizes.back() += 1;
+			const auto payload = payload_of(node);
 			switch (token) {
-			case Token::ObjectBeginToken: {
-				object_begin_indices.push_back(_tape.size());
-				object_sizes.push_back(0);
-				_tape.push_back({token, {.object_begin = {.end_index = 123123, .saturation = 456456}}});
+			case Token::ObjectBeginToken:
+				writer.put('{');
+				scopes.push_back({true, true, false});
 				break;
-			}
-			case Token::ObjectEndToken: {
-				object_sizes.back() -= 1;
-				const auto object_begin_index = object_begin_indices.back();
-				const auto object_size = object_sizes.back() / 2;
-				// Push the object end token.
-				_tape.push_back({token, {.object_index = object_begin_index}});
-				// Update the object begin token with the end index and saturation.
-				_tape[object_begin_index].second.object_begin = {.end_index = _tape.size(), .saturation = object_size};
-				object_begin_indices.pop_back();
-				object_sizes.pop_back();
+			case Token::ArrayBeginToken:
+				writer.put('[');
+				scopes.push_back({false, true, false});
 				break;
-			}
-			case Token::ArrayBeginToken: {
-				object_begin_indices.push_back(_tape.size());
-				object_sizes.push_back(0);
-				_tape.push_back({token, {.object_begin = {.end_index = 123123, .saturation = 456456}}});
+			case Token::ObjectEndToken:
+				writer.put('}');
+				scopes.pop_back();
 				break;
-			}
-			case Token::ArrayEndToken: {
-				object_sizes.back() -= 1;
-				const auto object_begin_index = object_begin_indices.back();
-				const auto object_size = object_sizes.back();
-				// Push the object end token.
-				_tape.push_back({token, {.object_index = object_begin_index}});
-				// Update the object begin token with the end index and saturation.
-				_tape[object_begin_index].second.object_begin = {.end_index = _tape.size(), .saturation = object_size};
-				object_begin_indices.pop_back();
-				object_sizes.pop_back();
+			case Token::ArrayEndToken:
+				writer.put(']');
+				scopes.pop_back();
 				break;
-			}
 			case Token::StringToken:
-				_tape.push_back({token, {.string_index = string_index++}});
+				writer.put('"');
+				writer.write_escaped(_strings[payload], JSON_ESCAPES);
+				writer.put('"');
+				break;
+			case Token::IntegerToken:
+				writer.write_integer(_numbers[payload].integer);
 				break;
 			case Token::FloatToken:
-				throw std::runtime_error("Floats are not supported");
+				writer.write_float(_numbers[payload].floating_point);
 				break;
-			case Token::IntegerToken:
-				throw std::runtime_error("Integers are not supported");
+			case Token::TrueToken:
+				writer.write("true");
 				break;
-			case Token::EndOfTokens:
-				_tape.push_back({Token::EndOfTokens, {.object_index = 0}});
-				_tape[0].second.object_index = _tape.size();
+			case Token::FalseToken:
+				writer.write("false");
+				break;
+			case Token::NullToken:
+				writer.write("null");
 				break;
 			default:
 				break;
 			}
 		}
+	}
 
-		if (string_index != _strings.size()) {
-			throw std::runtime_error("String count missmatch: " + std::to_string(string_index) + " string tokens vs " +
-									 std::to_string(_strings.size()) + " strings.");
-		}
+	/// The document as JSON text, see write_json().
+	std::string to_json(const JsonFormat format = JsonFormat::Minified) const {
+		auto os = std::ostringstream{};
+		write_json(os, format);
+		return os.str();
+	}
+
+	static TapeNode make_node(const Token token, const uint64_t payload) {
+		return (static_cast<TapeNode>(token) << TAPE_PAYLOAD_BITS) | (payload & TAPE_PAYLOAD_MASK);
+	}
+
+	static TapeNode make_scope_begin_node(const Token token, const size_t end_index, const size_t saturation) {
+		return make_node(token, (std::min<uint64_t>(saturation, MAX_SATURATION) << TAPE_END_INDEX_BITS) |
+									(end_index & TAPE_END_INDEX_MASK));
 	}
 
-	void _print_token(std::ostream &os, const std::pair<Token, JsonValue> &token_value_pair) const {
-		const auto &[token, value] = token_value_pair;
+	static Token token_of(const TapeNode node) { return static_cast<Token>(node >> TAPE_PAYLOAD_BITS); }
+	static uint64_t payload_of(const TapeNode node) { return node & TAPE_PAYLOAD_MASK; }
+	static size_t end_index_of(const TapeNode node) { return payload_of(node) & TAPE_END_INDEX_MASK; }
+	static size_t saturation_of(const TapeNode node) { return payload_of(node) >> TAPE_END_INDEX_BITS; }
+
+	// private:
+	void _write_token(BufferedWriter &writer, const TapeNode node) const {
+		const auto token = token_of(node);
+		const auto payload = payload_of(node);
 		switch (token) {
 		case Token::StartOfTokens:
-			os << "r\t// pointing to " << value.object_index << " (right after last node)";
+			writer.write("r\t// pointing to ");
+			writer.write_integer(payload);
+			writer.write(" (right after last node)");
 			break;
 		case Token::EndOfTokens:
 			break;
 		case Token::ObjectBeginToken:
-			os << "{\t// pointing to next tape location " << value.object_begin.end_index
-			   << " (first node after the scope),  saturated count " << value.object_begin.saturation;
+			writer.write("{\t// pointing to next tape location ");
+			writer.write_integer(end_index_of(node));
+			writer.write(" (first node after the scope),  saturated count ");
+			writer.write_integer(saturation_of(node));
 			break;
 		case Token::ObjectEndToken:
-			os << "}\t// pointing to previous tape location " << value.object_index << " (start of the scope)";
+			writer.write("}\t// pointing to previous tape location ");
+			writer.write_integer(payload);
+			writer.write(" (start of the scope)");
 			break;
 		case Token::ArrayBeginToken:
-			os << "[\t// pointing to next tape location " << value.object_begin.end_index
-			   << " (first node after the scope)"
-			   << ",  saturated count " << value.object_begin.saturation;
+			writer.write("[\t// pointing to next tape location ");
+			writer.write_integer(end_index_of(node));
+			writer.write(" (first node after the scope),  saturated count ");
+			writer.write_integer(saturation_of(node));
 			break;
 		case Token::ArrayEndToken:
-			os << "]\t// pointing to previous tape location " << value.object_index << " (start of the scope)";
+			writer.write("]\t// pointing to previous tape location ");
+			writer.write_integer(payload);
+			writer.write(" (start of the scope)");
 			break;
-		case Token::StringToken: {
-			auto out_string = std::regex_replace(_strings[value.string_index], std::regex(R"(\\)"), R"(\\)");
-			out_string = std::regex_replace(out_string, std::regex("\""), "\\\"");
-			out_string = std::regex_replace(out_string, std::regex("\n"), "\\n");
-			os << "string \"" << out_string << "\"";
+		case Token::StringToken:
+			writer.write("string \"");
+			writer.write_escaped(_strings[payload], TAPE_ESCAPES);
+			writer.put('"');
+			break;
+		case Token::IntegerToken:
+			writer.write("integer ");
+			writer.write_integer(_numbers[payload].integer);
+			break;
+		case Token::FloatToken:
+			writer.write("float ");
+			writer.write_float_short(_numbers[payload].floating_point);
+			break;
+		case Token::TrueToken:
+			writer.write("true");
+			break;
+		case Token::FalseToken:
+			writer.write("false");
+			break;
+		case Token::NullToken:
+			writer.write("null");
 			break;
-		}
 		default:
 			break;
 		}
 	}
 
-	uint64_t count_string_lengths() const {
-		auto count = uint64_t{0};
-		for (const auto &s : _strings) {
-			count += s.size();
-		}
-		return count;
-	}
+	/// Number of nodes on the tape, including the root node.
+	size_t node_count() const { return _tape.size(); }
+	/// Number of strings, keys included.
+	size_t string_count() const { return _strings.size(); }
+
+	uint64_t count_string_lengths() const { return _strings.total_length(); }
 
 	uint64_t count_string_chars() const {
 		auto count = uint64_t{0};
-		for (const auto &s : _strings) {
-			for (const auto c : s) {
-				count += c;
-			}
+		for (const auto c : _strings.chars()) {
+			count += c;
 		}
 		return count;
 	}
@@ -171,8 +339,8 @@ class TapedJson {
 	uint32_t max_depth() const {
 		auto max_depth = uint32_t{0};
 		auto current_depth = uint32_t{0};
-		for (const auto &[token, value] : _tape) {
-			switch (token) {
+		for (const auto node : _tape) {
+			switch (token_of(node)) {
 			case Token::ObjectBeginToken:
 			case Token::ArrayBeginToken:
 				++current_depth;
@@ -190,6 +358,7 @@ class TapedJson {
 	}
 
   private:
-	std::vector<std::pair<Token, JsonValue>> _tape;
-	std::vector<std::string> _strings;
+	std::vector<TapeNode> _tape;
+	StringArena _strings;
+	std::vector<NumberValue> _numbers;
 };
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "constexpr_math.hpp"
 #include "definitions.hpp"
 #include "unrolled_loop.hpp"
+#include <algorithm>
 #include <exception>
 #include <pipe_utils.hpp>
 #include <string_view>
@@ -15,109 +17,453 @@ const sycl::stream &operator<<(const sycl::stream &stream, const Bitmap &map) {
 	return stream;
 }
 
+/// Bitmap with every odd bit set, counted from the start of the line.
+Bitmap odd_bits() {
+	auto bits = Bitmap{};
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto index) { bits[index] = index % 2 == 1; });
+	return bits;
+}
+
 /**
- * Compute the bitmaps for a single type of overflow on a single cache line.
- * @tparam InitialState Which overflow state to start with.
- * @param input Input to compute bitmaps for.
- * @return pair of Bitmaps for concrete initial state and input and the tokens inside a CacheLine
+ * Subtract two bitmaps as if they were unsigned integers with the least significant bit at index 0.
+ * The borrow is rippled in 64 bit words so this maps onto native adders regardless of the line width.
+ * @param lhs Minuend.
+ * @param rhs Subtrahend.
+ * @return lhs - rhs, modulo 2^CACHE_LINE_SIZE.
  */
-std::pair<Bitmaps, CacheLine> compute_bitmaps(OverflowState state, const CacheLine &input) {
-	auto bitmaps = Bitmaps{};
+Bitmap subtract(const Bitmap &lhs, const Bitmap &rhs) {
+	constexpr auto WORD_SIZE = size_t{64};
+	constexpr auto WORD_COUNT = (CACHE_LINE_SIZE + WORD_SIZE - 1) / WORD_SIZE;
+	const auto word_mask = ~Bitmap{} >> (CACHE_LINE_SIZE > WORD_SIZE ? CACHE_LINE_SIZE - WORD_SIZE : 0);
 
-	auto token_index = size_t{0};
-	auto tokens = CacheLine{};
+	auto result = Bitmap{};
+	auto borrow = uint64_t{0};
+	fpga_tools::UnrolledLoop<WORD_COUNT>([&](auto word_index) {
+		const auto shift = word_index * WORD_SIZE;
+		const auto a = ((lhs >> shift) & word_mask).to_ullong();
+		const auto b = ((rhs >> shift) & word_mask).to_ullong();
+		const auto difference = a - b - borrow;
+		borrow = (a < b || (a == b && borrow)) ? 1 : 0;
+		result |= Bitmap{difference} << shift;
+	});
+	return result;
+}
+
+/**
+ * Compute the prefix XOR of a bitmap, i.e. bit i of the result is the XOR of bits 0..i of the input.
+ * Applied to the unescaped quotes this yields the in-string mask in log2(CACHE_LINE_SIZE) steps.
+ */
+Bitmap prefix_xor(Bitmap bitmap) {
+	fpga_tools::UnrolledLoop<fpga_tools::CeilLog2(CACHE_LINE_SIZE)>([&](auto step) { bitmap ^= bitmap << (1 << step); });
+	return bitmap;
+}
+
+/**
+ * Find all characters preceded by an odd-length run of backslashes.
+ * @param backslashes Positions of all backslashes in the line.
+ * @param first_is_escaped Whether the first character is escaped by a backslash from the previous line.
+ * @param last_is_escape Set to whether the last character is a backslash escaping the first one of the next line.
+ * @return Positions of all escaped characters.
+ */
+Bitmap find_escaped(const Bitmap &backslashes, const bool first_is_escaped, bool &last_is_escape) {
+	const auto carried = Bitmap{first_is_escaped ? 1u : 0u};
+	// A backslash that is escaped itself cannot start an escape sequence.
+	const auto potential_escapes = backslashes & ~carried;
+	// Subtracting the run starts from the (shifted) runs flips every bit up to the end of a run starting on an odd
+	// bit, which leaves the escape and escaped characters alternating in each run.
+	const auto maybe_escaped_and_odd_bits = (potential_escapes << 1) | odd_bits();
+	const auto escape_and_terminal_code = subtract(maybe_escaped_and_odd_bits, potential_escapes) ^ odd_bits();
+
+	const auto escaped = escape_and_terminal_code ^ (backslashes | carried);
+	const auto escapes = escape_and_terminal_code & backslashes;
+	last_is_escape = escapes[CACHE_LINE_SIZE - 1];
+	return escaped;
+}
+
+/**
+ * Map a single byte outside of any string to the token it starts.
+ * @param c The byte to classify.
+ * @return The token for structural characters, separators, quotes and the first character of a number or literal,
+ * Token::EndOfTokens for everything else.
+ */
+Token classify(const char c) {
+	switch (c) {
+	case '{':
+		return Token::ObjectBeginToken;
+	case '}':
+		return Token::ObjectEndToken;
+	case '[':
+		return Token::ArrayBeginToken;
+	case ']':
+		return Token::ArrayEndToken;
+	case '"':
+		return Token::StringToken;
+	case '-':
+	case '0':
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+	case '5':
+	case '6':
+	case '7':
+	case '8':
+	case '9':
+		return Token::NumberToken;
+	case 't':
+		return Token::TrueToken;
+	case 'f':
+		return Token::FalseToken;
+	case 'n':
+		return Token::NullToken;
+	case ':':
+		return Token::ColonToken;
+	case ',':
+		return Token::CommaToken;
+	default:
+		return Token::EndOfTokens;
+	}
+}
+
+/// Whether a byte can be part of a number.
+bool is_number_char(const char c) {
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
 
-	auto emit_token = [&](Token token) { tokens[token_index++] = token; };
+/// Whether a byte can occur outside of strings in JSON text, apart from the letters of true, false and null.
+bool is_allowed_outside_string(const char c) {
+	switch (c) {
+	case ' ':
+	case '\t':
+	case '\n':
+	case '\r':
+	case '{':
+	case '}':
+	case '[':
+	case ']':
+	case ':':
+	case ',':
+	case '"':
+		return true;
+	default:
+		return is_number_char(c);
+	}
+}
+
+/// Whether a byte is an ASCII letter.
+bool is_letter(const char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
 
-	// bitmaps.input = input;
-	for (auto byte_index = size_t{0}; byte_index < CACHE_LINE_SIZE; ++byte_index) {
+/// Longest literal, false.
+constexpr auto MAX_LITERAL_LENGTH = size_t{5};
+
+/// Spelling of a literal token, empty for all other tokens.
+constexpr std::string_view literal_of(const Token token) {
+	switch (token) {
+	case Token::TrueToken:
+		return "true";
+	case Token::FalseToken:
+		return "false";
+	case Token::NullToken:
+		return "null";
+	default:
+		return "";
+	}
+}
+
+/// A literal that continues on the next line, carried between lines like the OverflowState.
+struct LiteralState {
+	/// Token of the literal, Token::EndOfTokens if none continues.
+	Token token;
+	/// Letters of the literal on the lines before. If all of them are, the next line still has to end it.
+	uint8_t matched_count;
+};
+
+/// State the tokenizer carries from one line to the next, and across launches.
+struct TokenizerState {
+	OverflowState overflow_state;
+	LiteralState literal;
+};
+
+/// Bytes of a line that play a role in tokenizing it, each classified on its own.
+struct ByteClasses {
+	Bitmap quotes;
+	Bitmap backslashes;
+	/// Braces and brackets.
+	Bitmap structurals;
+	/// Colons and commas.
+	Bitmap separators;
+	/// Bytes that may occur outside of strings, see is_allowed_outside_string().
+	Bitmap allowed;
+	/// ASCII letters, which may only occur outside of strings in literals and in the exponent of a number.
+	Bitmap letters;
+	/// Bytes that may be part of a number, see is_number_char().
+	Bitmap number_chars;
+	/// Bytes a number may start with, i.e. digits and the minus sign.
+	Bitmap number_firsts;
+	/// 't', 'f' and 'n', which only occur as the first letter of true, false and null.
+	Bitmap literal_firsts;
+	/// Document separators, see compute_bitmaps().
+	Bitmap document_ends;
+};
+
+/// Classify all bytes of a line in parallel, see ByteClasses.
+ByteClasses classify_bytes(const CacheLine &input, const char document_separator) {
+	auto classes = ByteClasses{};
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
 		const auto here = input[byte_index];
-		switch (state) {
-		case OverflowState::None:
-			switch (here) {
-			case '{':
-				emit_token(Token::ObjectBeginToken);
-				break;
-			case '}':
-				emit_token(Token::ObjectEndToken);
-				break;
-			case '[':
-				emit_token(Token::ArrayBeginToken);
-				break;
-			case ']':
-				emit_token(Token::ArrayEndToken);
-				break;
-			case '"':
-				emit_token(Token::StringToken);
-				state = OverflowState::String;
-				break;
-			default:
-				// not supposed to happen for now
-				break;
+		classes.quotes[byte_index] = here == '"';
+		classes.backslashes[byte_index] = here == '\\';
+		classes.structurals[byte_index] = here == '{' || here == '}' || here == '[' || here == ']';
+		classes.separators[byte_index] = here == ':' || here == ',';
+		classes.allowed[byte_index] = is_allowed_outside_string(here);
+		classes.letters[byte_index] = is_letter(here);
+		classes.number_chars[byte_index] = is_number_char(here);
+		classes.number_firsts[byte_index] = here == '-' || (here >= '0' && here <= '9');
+		classes.literal_firsts[byte_index] = here == 't' || here == 'f' || here == 'n';
+		classes.document_ends[byte_index] = here == document_separator && document_separator != NO_DOCUMENT_SEPARATOR;
+	});
+	return classes;
+}
+
+/**
+ * Find the literals of a line that are spelled correctly and end before a byte that cannot continue them, i.e. a byte
+ * other than a letter or number character. A literal at the end of the line is accepted as far as it goes and checked
+ * with the next line, which gets its letters through the carried state.
+ * @param state Literal continuing from the previous line, updated to the one continuing on the next line.
+ * @param input Line to search.
+ * @param classes Classes of the bytes of the line.
+ * @param is_string Bytes inside of strings.
+ * @param continuation_is_invalid Set to whether the literal of the previous line is misspelled or not ended here.
+ * @return Positions of all letters of accepted literals.
+ */
+Bitmap find_literals(LiteralState &state, const CacheLine &input, const ByteClasses &classes, const Bitmap &is_string,
+					 bool &continuation_is_invalid) {
+	const auto word_chars = classes.letters | classes.number_chars;
+	auto literals = Bitmap{};
+
+	// The letters of the literal from the previous line, and the byte after them.
+	continuation_is_invalid = false;
+	if (state.token != Token::EndOfTokens) {
+		const auto literal = literal_of(state.token);
+		const auto remaining = literal.size() - state.matched_count;
+		auto is_valid = true;
+		fpga_tools::UnrolledLoop<std::min(MAX_LITERAL_LENGTH + 1, CACHE_LINE_SIZE)>([&](auto byte_index) {
+			if (byte_index < remaining) {
+				is_valid &= input[byte_index] == literal[state.matched_count + byte_index];
+				literals[byte_index] = true;
+			} else if (byte_index == remaining) {
+				is_valid &= !word_chars[byte_index];
 			}
-			break;
-		case OverflowState::String:
-			if (here == '\"') {
-				state = OverflowState::None;
-			} else if (here == '\\') {
-				state = OverflowState::StringWithBackslash;
+		});
+		continuation_is_invalid = !is_valid;
+		if (!is_valid) {
+			literals = Bitmap{};
+		}
+		if (is_valid && remaining >= CACHE_LINE_SIZE) {
+			state.matched_count += CACHE_LINE_SIZE;
+		} else {
+			state = LiteralState{};
+		}
+	}
+
+	const auto literal_firsts = classes.literal_firsts & ~is_string;
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
+		if (literal_firsts[byte_index]) {
+			const auto token = classify(input[byte_index]);
+			const auto literal = literal_of(token);
+			auto is_valid = true;
+			fpga_tools::UnrolledLoop<1, MAX_LITERAL_LENGTH + 1>([&](auto letter_index) {
+				if (byte_index + letter_index < CACHE_LINE_SIZE) {
+					if (letter_index < literal.size()) {
+						is_valid &= input[byte_index + letter_index] == literal[letter_index];
+					} else if (letter_index == literal.size()) {
+						is_valid &= !word_chars[byte_index + letter_index];
+					}
+				}
+			});
+			if (is_valid) {
+				fpga_tools::UnrolledLoop<MAX_LITERAL_LENGTH>([&](auto letter_index) {
+					if (byte_index + letter_index < CACHE_LINE_SIZE && letter_index < literal.size()) {
+						literals[byte_index + letter_index] = true;
+					}
+				});
+				// Letters or the byte ending the literal are still to come.
+				if (byte_index + literal.size() >= CACHE_LINE_SIZE) {
+					state.token = token;
+					state.matched_count = static_cast<uint8_t>(CACHE_LINE_SIZE - byte_index);
+				}
 			}
-			break;
-		case OverflowState::StringWithBackslash:
-			bitmaps.is_escaped[byte_index] = true;
-			state = OverflowState::String;
-			break;
-		default:
-			// Cannot throw an exception, we just hope it works.
-			break;
 		}
-		bitmaps.is_string[byte_index] = state == OverflowState::String || state == OverflowState::StringWithBackslash;
+	});
+	return literals;
+}
+
+/// Whether the input cannot end with the literal of the state, because letters of it are missing.
+bool is_incomplete_literal(const LiteralState &state) {
+	return state.token != Token::EndOfTokens && state.matched_count < literal_of(state.token).size();
+}
+
+/**
+ * Compute the bitmaps and tokens of a single cache line from the classes of its bytes.
+ * @param state Overflow state of the previous line.
+ * @param literal_state Literal continuing from the previous line, updated to the one continuing on the next line.
+ * @param input Input to compute bitmaps for.
+ * @param classes Classes of the bytes of the input, e.g. from classify_bytes().
+ * @param unexpected Set to the positions of all bytes outside of strings that cannot occur in JSON.
+ * @return The input with its bitmaps for the concrete initial state, its tokens and their positions.
+ */
+TokenizedCacheLine tokenize(const OverflowState state, LiteralState &literal_state, const CacheLine &input,
+							const ByteClasses &classes, Bitmap &unexpected) {
+	const auto &quotes = classes.quotes;
+	const auto &structurals = classes.structurals;
+	const auto &separators = classes.separators;
+	const auto &literal_firsts = classes.literal_firsts;
+	const auto &document_ends = classes.document_ends;
+
+	const auto starts_in_string = state == OverflowState::String || state == OverflowState::StringWithBackslash;
+	const auto starts_escaped = state == OverflowState::StringWithBackslash;
+
+	auto ends_with_escape = false;
+	const auto escaped = find_escaped(classes.backslashes, starts_escaped, ends_with_escape);
+	const auto unescaped_quotes = quotes & ~escaped;
+
+	// The prefix XOR marks everything from an opening quote up to, but excluding, its closing quote.
+	auto is_string = prefix_xor(unescaped_quotes);
+	if (starts_in_string) {
+		is_string = ~is_string;
 	}
 
+	auto continuation_is_invalid = false;
+	const auto literals = find_literals(literal_state, input, classes, is_string, continuation_is_invalid);
+
+	auto bitmaps = Bitmaps{};
+	bitmaps.is_string = is_string;
+	bitmaps.is_escaped = escaped & is_string;
+	// The 'e' that ends true and false is not an exponent.
+	bitmaps.is_number = classes.number_chars & ~is_string & ~literals;
+	if (is_string[CACHE_LINE_SIZE - 1]) {
+		bitmaps.overflow_state = ends_with_escape ? OverflowState::StringWithBackslash : OverflowState::String;
+	} else if (bitmaps.is_number[CACHE_LINE_SIZE - 1]) {
+		bitmaps.overflow_state = OverflowState::Number;
+	} else {
+		bitmaps.overflow_state = OverflowState::None;
+	}
+
+	// A number starts with a digit or minus that does not continue a number from the previous byte.
+	const auto continues_number = (bitmaps.is_number << 1) | Bitmap{state == OverflowState::Number ? 1u : 0u};
+	const auto number_starts = bitmaps.is_number & classes.number_firsts & ~continues_number;
+
+	// Structural characters, separators, literals and document separators outside of strings, opening quotes and
+	// number starts each start a token.
+	const auto token_starts = ((structurals | separators | literal_firsts | document_ends) & ~is_string) |
+							  (unescaped_quotes & is_string) | number_starts;
+	// Letters are only allowed in literals and as exponent markers, which cannot start a number.
+	unexpected = ~(classes.allowed | literals | document_ends | is_string) |
+				 (classes.letters & bitmaps.is_number & ~continues_number);
+	unexpected[0] = unexpected[0] || continuation_is_invalid;
+
+	auto token_index = size_t{0};
+	auto tokens = CacheLine{};
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
+		if (token_starts[byte_index]) {
+			tokens[token_index++] = document_ends[byte_index] ? Token::DocumentEndToken : classify(input[byte_index]);
+		}
+	});
+
 	if (token_index != CACHE_LINE_SIZE) {
-		emit_token(Token::EndOfTokens);
+		tokens[token_index] = Token::EndOfTokens;
 	}
 
-	bitmaps.overflow_state = state;
-	return {bitmaps, tokens};
+	return {input, bitmaps, tokens, token_starts};
+}
+
+/**
+ * Compute the bitmaps and tokens of a single cache line.
+ * All bytes are classified in parallel; the only state carried between lines is the overflow state, which tells
+ * whether the line starts inside of a string or a number and whether its first character is escaped, and the literal
+ * the line may start in the middle of.
+ * @param state Overflow state of the previous line.
+ * @param literal_state Literal continuing from the previous line, updated to the one continuing on the next line.
+ * @param input Input to compute bitmaps for.
+ * @param unexpected Set to the positions of all bytes outside of strings that cannot occur in JSON.
+ * @param document_separator Byte that separates documents outside of strings, e.g. '\n' for NDJSON. Emits a
+ * Token::DocumentEndToken unless it is NO_DOCUMENT_SEPARATOR.
+ * @return The input with its bitmaps for the concrete initial state, its tokens and their positions.
+ */
+TokenizedCacheLine compute_bitmaps(const OverflowState state, LiteralState &literal_state, const CacheLine &input,
+								   Bitmap &unexpected, const char document_separator = NO_DOCUMENT_SEPARATOR) {
+	return tokenize(state, literal_state, input, classify_bytes(input, document_separator), unexpected);
 }
 
 /**
  * Compute bitmaps by reading cache lines from input pipe and writing complete
  * bitmaps to output pipe.
- * @tparam CacheLineInputPipe Input pipe to read from.
- * @tparam BitmapsOutputPipe Output pipe to write to.
+ * @tparam InPipes Input pipes to read from, one per lane.
+ * @tparam OutPipes Output pipes to write to, one per lane.
+ * @tparam LaneCount Number of consecutive lines handled per iteration. The overflow state of each line is passed on to
+ * the next lane within the same iteration.
  * @param q Queue to use.
- * @param cache_line_count Number of cache lines to expect.
+ * @param cache_line_count Number of cache lines to expect, a multiple of LaneCount.
+ * @param status Shared allocation the first unexpected character is reported to, unless it already holds an error.
+ * @param input_offset Offset of the first line in the input, used to locate errors.
+ * @param carried_state If given, the state to start with, updated with the state after the last line. Used to continue
+ * a document across multiple launches.
+ * @param is_end_of_input Whether the last line ends the input, which must not end in the middle of a literal.
+ * @param dependencies Events to wait for before starting.
+ * @param document_separator Byte that separates multiple documents in the input, see compute_bitmaps().
  */
-template <typename Id, typename InPipe, typename OutPipe>
-sycl::event submit_tokenizer(sycl::queue &q, const size_t cache_line_count) {
+template <typename Id, typename InPipes, typename OutPipes, size_t LaneCount>
+sycl::event submit_tokenizer(sycl::queue &q, const size_t cache_line_count, ParseStatus *status,
+							 const size_t input_offset, TokenizerState *carried_state = nullptr,
+							 const bool is_end_of_input = true, const std::vector<sycl::event> &dependencies = {},
+							 const char document_separator = NO_DOCUMENT_SEPARATOR) {
 	const auto tokenizer_event = q.submit([&](auto &h) {
+		h.depends_on(dependencies);
 		// auto out = sycl::stream(4096, 1024, h);
 		h.template single_task<Id>([=]() {
-			auto last_overflow_state = OverflowState::None;
+			auto state = carried_state != nullptr ? *carried_state : TokenizerState{};
+			auto local_status = ParseStatus{};
+
+			// Only the overflow and literal state are carried between iterations, so LaneCount lines can be accepted
+			// per clock.
+			[[intel::initiation_interval(1)]] for (auto line_index = size_t{0}; line_index < cache_line_count;
+												   line_index += LaneCount) {
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					const auto input = InPipes::template PipeAt<lane>::read();
 
-			for (auto line_index = size_t{0}; line_index < cache_line_count; ++line_index) {
-				const auto input = InPipe::read();
+					// out << "Input: ";
+					// for (auto c : input) {
+					// 	if (std::isprint(c)) {
+					// 		out << c;
+					// 	} else {
+					// 		out << ".";
+					// 	}
+					// }
+					// out << "\n";
 
-				// out << "Input: ";
-				// for (auto c : input) {
-				// 	if (std::isprint(c)) {
-				// 		out << c;
-				// 	} else {
-				// 		out << ".";
-				// 	}
-				// }
-				// out << "\n";
+					auto unexpected = Bitmap{};
+					const auto tokenized =
+						compute_bitmaps(state.overflow_state, state.literal, input, unexpected, document_separator);
+					state.overflow_state = tokenized.bitmaps.overflow_state;
+					if (unexpected.any()) {
+						const auto line_offset = input_offset + (line_index + lane) * CACHE_LINE_SIZE;
+						local_status.report(ErrorCode::UnexpectedCharacter, line_offset + first_set_index(unexpected));
+					}
 
-				const auto [bitmaps, tokens] = compute_bitmaps(last_overflow_state, input);
-				last_overflow_state = bitmaps.overflow_state;
+					// out << "string:" << tokenized.bitmaps.is_string << "\n"
+					// 	<< "escapd:" << tokenized.bitmaps.is_escaped << "\n";
 
-				// out << "string:" << bitmaps.is_string << "\n"
-				// 	<< "escapd:" << bitmaps.is_escaped << "\n";
+					OutPipes::template PipeAt<lane>::write(tokenized);
+				});
+			}
 
-				OutPipe::write({input, bitmaps, tokens});
+			if (is_end_of_input && is_incomplete_literal(state.literal)) {
+				local_status.report(ErrorCode::UnexpectedCharacter, input_offset + cache_line_count * CACHE_LINE_SIZE);
+			}
+			if (carried_state != nullptr) {
+				*carried_state = state;
 			}
+			status->report(local_status.code, local_status.offset);
 		});
 	});
 
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "definitions.hpp"
+#include "unrolled_loop.hpp"
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#include <sycl/sycl.hpp>
+
+/// Bytes of a cache line classified by their role in UTF-8 sequences.
+struct Utf8Classes {
+	/// First bytes of two, three and four byte sequences.
+	Bitmap leads_2;
+	Bitmap leads_3;
+	Bitmap leads_4;
+	/// First bytes that restrict the range of the byte after them.
+	Bitmap is_e0;
+	Bitmap is_ed;
+	Bitmap is_f0;
+	Bitmap is_f4;
+};
+
+/// State of the UTF-8 validator, carried across cache lines.
+struct Utf8State {
+	/// Classes of the previous line, whose last bytes may start a sequence that continues in this line.
+	Utf8Classes previous;
+};
+
+/// Shift a bitmap by `distance` bytes towards the end of the line, filling in the last bytes of the previous line.
+Bitmap shift_in(const Bitmap &current, const Bitmap &previous, const size_t distance) {
+	return (current << distance) | (previous >> (CACHE_LINE_SIZE - distance));
+}
+
+/**
+ * Find all bytes of a line that break UTF-8 well-formedness, following the rules of Unicode Table 3-7. Every byte is
+ * checked against the up to three bytes before it, so all bytes are checked in parallel.
+ * @param input Line to check.
+ * @param previous Classes of the previous line, updated to the classes of this line.
+ * @return Positions of all invalid bytes.
+ */
+Bitmap find_invalid_utf8(const CacheLine &input, Utf8Classes &previous) {
+	auto classes = Utf8Classes{};
+	auto continuations = Bitmap{};
+	auto never_valid = Bitmap{};
+	auto below_a0 = Bitmap{};
+	auto below_90 = Bitmap{};
+	fpga_tools::UnrolledLoop<CACHE_LINE_SIZE>([&](auto byte_index) {
+		const auto byte = static_cast<uint8_t>(input[byte_index]);
+		continuations[byte_index] = byte >= 0x80 && byte < 0xC0;
+		never_valid[byte_index] = byte == 0xC0 || byte == 0xC1 || byte >= 0xF5;
+		classes.leads_2[byte_index] = byte >= 0xC0 && byte < 0xE0;
+		classes.leads_3[byte_index] = byte >= 0xE0 && byte < 0xF0;
+		classes.leads_4[byte_index] = byte >= 0xF0;
+		classes.is_e0[byte_index] = byte == 0xE0;
+		classes.is_ed[byte_index] = byte == 0xED;
+		classes.is_f0[byte_index] = byte == 0xF0;
+		classes.is_f4[byte_index] = byte == 0xF4;
+		below_a0[byte_index] = byte < 0xA0;
+		below_90[byte_index] = byte < 0x90;
+	});
+
+	// A byte must be a continuation if and only if one of the three bytes before it starts a sequence that long.
+	const auto must_continue = shift_in(classes.leads_2 | classes.leads_3 | classes.leads_4,
+										previous.leads_2 | previous.leads_3 | previous.leads_4, 1) |
+							   shift_in(classes.leads_3 | classes.leads_4, previous.leads_3 | previous.leads_4, 2) |
+							   shift_in(classes.leads_4, previous.leads_4, 3);
+
+	// Overlong encodings, surrogates and code points above U+10FFFF are ruled out by the second byte.
+	const auto out_of_range = (shift_in(classes.is_e0, previous.is_e0, 1) & below_a0) |
+							  (shift_in(classes.is_ed, previous.is_ed, 1) & ~below_a0) |
+							  (shift_in(classes.is_f0, previous.is_f0, 1) & below_90) |
+							  (shift_in(classes.is_f4, previous.is_f4, 1) & ~below_90);
+
+	previous = classes;
+	return (must_continue ^ continuations) | never_valid | (out_of_range & continuations);
+}
+
+/// Whether the last bytes of a line start a sequence that is not complete within it.
+bool ends_in_sequence(const Utf8Classes &last) {
+	const auto expects_more = (last.leads_2 | last.leads_3 | last.leads_4) >> (CACHE_LINE_SIZE - 1) |
+							  (last.leads_3 | last.leads_4) >> (CACHE_LINE_SIZE - 2) |
+							  last.leads_4 >> (CACHE_LINE_SIZE - 3);
+	return expects_more.any();
+}
+
+/**
+ * Validate that the input is well-formed UTF-8 by reading cache lines from the input pipes and forwarding them
+ * unchanged to the output pipes, so validation runs side by side with the rest of the pipeline.
+ * @tparam InPipes Input pipes to read from, one per lane.
+ * @tparam OutPipes Output pipes to write to, one per lane.
+ * @tparam LaneCount Number of consecutive lines handled per iteration.
+ * @param q Queue to use.
+ * @param cache_line_count Number of cache lines to expect, a multiple of LaneCount.
+ * @param status Shared allocation the first invalid byte is reported to, unless it already holds an error. A sequence
+ * truncated by the end of the input is reported at the end of the input.
+ * @param input_offset Offset of the first line in the input, used to locate errors.
+ * @param carried_state If given, the state to start with, updated with the state after the last line. Used to
+ * continue a document across multiple launches.
+ * @param is_end_of_input Whether the last line ends the input, so a sequence still open is truncated.
+ * @param dependencies Events to wait for before starting.
+ */
+template <typename Id, typename InPipes, typename OutPipes, size_t LaneCount>
+sycl::event submit_utf8_validator(sycl::queue &q, const size_t cache_line_count, ParseStatus *status,
+								  const size_t input_offset, Utf8State *carried_state = nullptr,
+								  const bool is_end_of_input = true,
+								  const std::vector<sycl::event> &dependencies = {}) {
+	const auto utf8_validator_event = q.submit([&](auto &h) {
+		h.depends_on(dependencies);
+		h.template single_task<Id>([=]() {
+			auto state = carried_state != nullptr ? *carried_state : Utf8State{};
+			auto local_status = ParseStatus{};
+
+			[[intel::initiation_interval(1)]] for (auto index = size_t{0}; index < cache_line_count;
+												   index += LaneCount) {
+				fpga_tools::UnrolledLoop<LaneCount>([&](auto lane) {
+					const auto line = InPipes::template PipeAt<lane>::read();
+
+					const auto invalid = find_invalid_utf8(line, state.previous);
+					if (invalid.any()) {
+						local_status.report(ErrorCode::InvalidUtf8,
+											input_offset + (index + lane) * CACHE_LINE_SIZE + first_set_index(invalid));
+					}
+
+					OutPipes::template PipeAt<lane>::write(line);
+				});
+			}
+
+			if (is_end_of_input && ends_in_sequence(state.previous)) {
+				local_status.report(ErrorCode::InvalidUtf8, input_offset + cache_line_count * CACHE_LINE_SIZE);
+			}
+
+			if (carried_state != nullptr) {
+				*carried_state = state;
+			}
+			status->report(local_status.code, local_status.offset);
+		});
+	});
+
+	return utf8_validator_event;
+}
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "parse_error.hpp"
+#include "test_utils.hpp"
+
+/// The error of parsing a batch, nothing if all of its documents are valid.
+std::optional<ParseError> parse_batch_error(JsonParser &parser, const std::vector<std::string> &documents) {
+	try {
+		parser.parse_batch(documents);
+		return std::nullopt;
+	} catch (const ParseError &e) {
+		return e;
+	}
+}
+
+/**
+ * Check that parsing a batch fails in the given document.
+ * @param report Report to record the checks in.
+ * @param parser Parser to parse with.
+ * @param documents Batch to parse.
+ * @param expected Error the batch results in.
+ * @param document_index Index of the document the error is in.
+ * @param offset Offset of the error within its document.
+ * @param description What is parsed, to report failures with.
+ */
+void check_batch_error(TestReport &report, JsonParser &parser, const std::vector<std::string> &documents,
+					   const ErrorCode expected, const size_t document_index, const size_t offset,
+					   const std::string &description) {
+	const auto error = parse_batch_error(parser, documents);
+	report.check(error.has_value(), description + ": no error");
+	if (error) {
+		report.check_equal(to_string(error->code()), to_string(expected), description + ": error");
+		report.check(error->document_index() == document_index,
+					 description + ": error in document " + std::to_string(error->document_index().value_or(-1)));
+		report.check_equal(std::to_string(error->offset()), std::to_string(offset), description + ": offset");
+	}
+}
+
+/**
+ * Check that NDJSON parses into the given documents, with the input at every offset relative to the lines of the
+ * pipeline so that every document spans a line boundary somewhere.
+ * @param report Report to record the checks in.
+ * @param parser Parser to parse with.
+ * @param input NDJSON to parse.
+ * @param expected Documents the input results in, as TapedJson::to_json() writes them.
+ * @param description What is parsed, to report failures with.
+ */
+void check_ndjson(TestReport &report, JsonParser &parser, const std::string &input,
+				  const std::vector<std::string> &expected, const std::string &description) {
+	for (auto indent = size_t{0}; indent <= CACHE_LINE_SIZE; ++indent) {
+		const auto where = description + " indented by " + std::to_string(indent);
+		try {
+			const auto documents = parser.parse_ndjson(std::string(indent, ' ') + input);
+			report.check_equal(std::to_string(documents.size()), std::to_string(expected.size()),
+							   where + ": document count");
+			for (auto index = size_t{0}; index < documents.size() && index < expected.size(); ++index) {
+				report.check_equal(documents[index].to_json(), expected[index],
+								   where + ": document " + std::to_string(index));
+			}
+		} catch (const ParseError &e) {
+			report.check(false, where + ": " + e.what());
+		}
+	}
+}
+
+/**
+ * Check that parsing NDJSON fails at the given offset, with the input at every offset relative to the lines of the
+ * pipeline.
+ * @param report Report to record the checks in.
+ * @param parser Parser to parse with.
+ * @param input NDJSON to parse.
+ * @param expected Error the input results in.
+ * @param offset Offset of the error in the input, which counts from the start of the input rather than its document.
+ * @param description What is parsed, to report failures with.
+ */
+void check_ndjson_error(TestReport &report, JsonParser &parser, const std::string &input, const ErrorCode expected,
+						const size_t offset, const std::string &description) {
+	for (auto indent = size_t{0}; indent <= CACHE_LINE_SIZE; ++indent) {
+		const auto where = description + " indented by " + std::to_string(indent);
+		try {
+			parser.parse_ndjson(std::string(indent, ' ') + input);
+			report.check(false, where + ": no error");
+		} catch (const ParseError &e) {
+			report.check_equal(to_string(e.code()), to_string(expected), where + ": error");
+			report.check_equal(std::to_string(e.offset()), std::to_string(indent + offset), where + ": offset");
+		}
+	}
+}
+
+int main() {
+	auto q = make_test_queue();
+	auto report = TestReport{};
+
+	for (const auto backend : {Backend::Device, Backend::Host}) {
+		auto parser = JsonParser{q, backend};
+		const auto backend_name = std::string{backend == Backend::Device ? "device" : "host"};
+
+		// Every document of a batch ends up at its own index.
+		const auto inputs = std::vector<std::string>{"{\"x\":[1,2]}", " \"y\" ", "3.5", "\n[true]\n"};
+		const auto documents = parser.parse_batch(inputs);
+		const auto expected = std::vector<std::string>{"{\"x\":[1,2]}", "\"y\"", "3.5", "[true]"};
+		report.check_equal(std::to_string(documents.size()), std::to_string(expected.size()),
+						   backend_name + " document count");
+		for (auto index = size_t{0}; index < documents.size() && index < expected.size(); ++index) {
+			report.check_equal(documents[index].to_json(), expected[index],
+							   backend_name + " document " + std::to_string(index));
+		}
+
+		// Empty documents are errors rather than missing from the result.
+		check_batch_error(report, parser, {"{\"x\":1}", "  ", "\"y\"", "3.5"}, ErrorCode::EmptyDocument, 1, 2,
+						  backend_name + " whitespace document");
+		check_batch_error(report, parser, {"{\"x\":1}", "\"y\"", ""}, ErrorCode::EmptyDocument, 2, 0,
+						  backend_name + " empty document");
+
+		// Errors are located within their document.
+		check_batch_error(report, parser, {"[1]", "{\"a\":2}", "[1,,2]"}, ErrorCode::UnexpectedToken, 2, 3,
+						  backend_name + " invalid document");
+		check_batch_error(report, parser, {"[1]", "[2", "3"}, ErrorCode::UnclosedScope, 1, 2,
+						  backend_name + " unclosed document");
+
+		report.check(parser.parse_batch({}).empty(), backend_name + " empty batch");
+
+		// NDJSON skips blank lines, with or without whitespace, and does not need a trailing newline.
+		check_ndjson(report, parser, "{\"a\":[1,2]}\n\"b\"\n3.5\n", {"{\"a\":[1,2]}", "\"b\"", "3.5"},
+					 backend_name + " ndjson with trailing newline");
+		check_ndjson(report, parser, "[1]\n[2]", {"[1]", "[2]"}, backend_name + " ndjson without trailing newline");
+		check_ndjson(report, parser, "\n[1]\n\n \t\n{}\n  \n3\n\n", {"[1]", "{}", "3"},
+					 backend_name + " ndjson with blank lines");
+		check_ndjson(report, parser, "\n\n", {}, backend_name + " ndjson of blank lines");
+
+		// A document longer than a line, next to short ones.
+		const auto long_document = "{\"key\":\"" + std::string(2 * CACHE_LINE_SIZE, 'x') + "\",\"values\":[1,2,3]}";
+		check_ndjson(report, parser, "[0]\n" + long_document + "\n[4]\n", {"[0]", long_document, "[4]"},
+					 backend_name + " ndjson with a long document");
+
+		// Errors of NDJSON are located within the whole input.
+		check_ndjson_error(report, parser, "[1]\n[2,]\n", ErrorCode::UnexpectedToken, 7,
+						   backend_name + " ndjson invalid document");
+		check_ndjson_error(report, parser, "[1]\n\n{\"a\" 1}\n", ErrorCode::UnexpectedToken, 10,
+						   backend_name + " ndjson missing colon");
+		check_ndjson_error(report, parser, "[1]\n[2\n3]\n", ErrorCode::UnclosedScope, 6,
+						   backend_name + " ndjson document split by a newline");
+
+		// Any separator works with documents in memory the device can access directly.
+		const auto separated = std::string{"[1]\x1e\x1e{\"a\":\"b\"}\x1e\"c\"\x1e"};
+		auto *input = sycl::malloc_host<char>(separated.size(), q);
+		std::copy(separated.begin(), separated.end(), input);
+		const auto separated_documents = parser.parse_documents(input, separated.size(), '\x1e');
+		const auto expected_documents = std::vector<std::string>{"[1]", "{\"a\":\"b\"}", "\"c\""};
+		report.check_equal(std::to_string(separated_documents.size()), std::to_string(expected_documents.size()),
+						   backend_name + " separated document count");
+		for (auto index = size_t{0}; index < separated_documents.size() && index < expected_documents.size(); ++index) {
+			report.check_equal(separated_documents[index].to_json(), expected_documents[index],
+							   backend_name + " separated document " + std::to_string(index));
+		}
+		const auto invalid = std::string{"[1]\x1e[2\x1e" "3]"};
+		std::copy(invalid.begin(), invalid.end(), input);
+		try {
+			parser.parse_documents(input, invalid.size(), '\x1e');
+			report.check(false, backend_name + " separated invalid document: no error");
+		} catch (const ParseError &e) {
+			report.check_equal(to_string(e.code()), to_string(ErrorCode::UnclosedScope),
+							   backend_name + " separated invalid document: error");
+			report.check_equal(std::to_string(e.offset()), std::to_string(6),
+							   backend_name + " separated invalid document: offset");
+		}
+		sycl::free(input, q);
+	}
+
+	return report.finish();
+}
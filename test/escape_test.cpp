@@ -0,0 +1,74 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "parse_error.hpp"
+#include "test_utils.hpp"
+
+/// UTF-8 of U+FFFD, which unpaired surrogates decode to.
+const std::string REPLACEMENT = "\xEF\xBF\xBD";
+
+/// Documents with escapes and what they parse to, as TapedJson::to_json() writes them.
+const std::vector<std::pair<std::string, std::string>> ESCAPES = {
+	{R"(["\"\\\/\b\f\n\r\t"])", R"(["\"\\/\b\f\n\r\t"])"},
+	{R"(["a\nb\tc\"d"])", R"(["a\nb\tc\"d"])"},
+	{R"(["\u0041\u00e9\u20AC"])", "[\"A\xC3\xA9\xE2\x82\xAC\"]"},
+	{R"(["\u0000\u001f\u007F"])", "[\"\\u0000\\u001f\x7F\"]"},
+	{R"(["\u0022\u005c\u002F"])", R"(["\"\\/"])"},
+	{R"({"\u006b\u0065\u0079":"\u0076"})", R"({"key":"v"})"},
+	// Surrogate pairs, in both cases and next to other escapes.
+	{R"(["\ud83d\ude00"])", "[\"\xF0\x9F\x98\x80\"]"},
+	{R"(["\uD83D\uDE00\uDBFF\uDFFF\n"])", "[\"\xF0\x9F\x98\x80\xF4\x8F\xBF\xBF\\n\"]"},
+	// Unpaired surrogates, at the end of a string, before other characters and escapes and around a pair.
+	{R"(["\ud800"])", "[\"" + REPLACEMENT + "\"]"},
+	{R"(["\udc00"])", "[\"" + REPLACEMENT + "\"]"},
+	{R"(["\ud800x"])", "[\"" + REPLACEMENT + "x\"]"},
+	{R"(["\ud800\n"])", "[\"" + REPLACEMENT + "\\n\"]"},
+	{R"(["\ud800\u0041"])", "[\"" + REPLACEMENT + "A\"]"},
+	{R"(["\ud800\ud83d\ude00\udc00"])", "[\"" + REPLACEMENT + "\xF0\x9F\x98\x80" + REPLACEMENT + "\"]"},
+	{R"(["\ud800","\ud800"])", "[\"" + REPLACEMENT + "\",\"" + REPLACEMENT + "\"]"},
+};
+
+/// Documents with strings that are not valid JSON, and the error they result in.
+const std::vector<std::pair<std::string, ErrorCode>> INVALID_STRINGS = {
+	{R"(["\x"])", ErrorCode::InvalidEscape},
+	{R"(["\U0041"])", ErrorCode::InvalidEscape},
+	{R"(["\u12"])", ErrorCode::InvalidEscape},
+	{R"(["\u12g4"])", ErrorCode::InvalidEscape},
+	{R"(["\ud800\u"])", ErrorCode::InvalidEscape},
+	{"[\"a\tb\"]", ErrorCode::UnescapedControlCharacter},
+	{R"(["\ud83d\ude00)", ErrorCode::UnclosedString},
+};
+
+int main() {
+	auto q = make_test_queue();
+	auto report = TestReport{};
+
+	for (const auto backend : {Backend::Device, Backend::Host}) {
+		auto parser = JsonParser{q, backend};
+		const auto backend_name = std::string{backend == Backend::Device ? "device" : "host"};
+
+		for (const auto &[document, expected] : ESCAPES) {
+			check_json(report, parser, document, expected, backend_name);
+		}
+		for (const auto &[document, expected] : INVALID_STRINGS) {
+			check_document(report, parser, document, expected, backend_name);
+		}
+
+		// A string closing at the first byte of a line that only then decodes the replacement character of its unpaired
+		// surrogate, followed by as many empty strings as fit into the line and the start of one more. Every string of
+		// the line gets a part of its own, one more than bytes can start.
+		const auto unpaired = std::string{R"(["\ud800)"};
+		auto parts = std::string((CACHE_LINE_SIZE - unpaired.size() % CACHE_LINE_SIZE) % CACHE_LINE_SIZE, ' ');
+		parts += unpaired + "\"";
+		for (auto index = size_t{0}; index < (CACHE_LINE_SIZE - 2) / 2; ++index) {
+			parts += "\"\"";
+		}
+		parts += "\"\"]";
+		report.check_equal(to_string(parse_error_code(parser, parts)), to_string(ErrorCode::UnexpectedToken),
+						   backend_name + " most string parts in a line");
+	}
+
+	return report.finish();
+}
@@ -0,0 +1,46 @@
+#include <string>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "parse_error.hpp"
+#include "test_utils.hpp"
+
+/// Documents with letters outside of strings that do not spell a literal, or a literal followed by more of a word.
+const std::vector<std::string> MISSPELLED_LITERALS = {
+	"[aaaa]", "[e5]", "[E5]", "[tru]", "[true1]", "[false-1]", "{\"a\":nulll}", "[truefalse]", "[True]",
+	"[nul]",  "[fals]", "[truee]", "[1,x]", "[nullx]", "tru", "[true.5]", "[false+1]",
+};
+
+/// Documents with letters outside of strings in literals and exponents only.
+const std::vector<std::string> VALID_LETTERS = {
+	"[true,false,null]", "{\"e\":true,\"f\":false}", "[1e5,true,2E-3,false]", "[\"true1\",\"aaaa\"]", "true",
+	"false", "null", "{\"a\":null}", "[true ,false\n,null\t]",
+};
+
+int main() {
+	auto q = make_test_queue();
+	auto report = TestReport{};
+
+	for (const auto backend : {Backend::Device, Backend::Host}) {
+		auto parser = JsonParser{q, backend};
+		const auto backend_name = std::string{backend == Backend::Device ? "device" : "host"};
+
+		for (const auto &document : MISSPELLED_LITERALS) {
+			check_document(report, parser, document, ErrorCode::UnexpectedCharacter, backend_name);
+		}
+		for (const auto &document : VALID_LETTERS) {
+			check_document(report, parser, document, ErrorCode::None, backend_name);
+		}
+
+		// A literal that ends the input right at the end of a line.
+		const auto literal_end = std::string(CACHE_LINE_SIZE - 3, ' ') + "tru";
+		report.check_equal(to_string(parse_error_code(parser, literal_end)), to_string(ErrorCode::UnexpectedCharacter),
+						   backend_name + " literal cut off by the end of the input");
+
+		// The 'e' of true and false does not start a number.
+		const auto json = parser.parse("[true,false,1e2]");
+		report.check_equal(json.to_json(), "[true,false,100.0]", backend_name + " literals and exponents");
+	}
+
+	return report.finish();
+}
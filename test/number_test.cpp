@@ -0,0 +1,116 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "test_utils.hpp"
+
+/// Decimals whose nearest double is hard to find: extremes of the range, subnormals, halfway cases and mantissas with
+/// more digits than the device keeps, also ones that the host rounds to zero or infinity.
+const std::vector<std::string> HARD_DECIMALS = {
+	"1.2345678901234567e-300",
+	"2.2250738585072014e-308",
+	"2.2250738585072011e-308",
+	"4.9406564584124654e-324",
+	"5e-324",
+	"2.4703282292062327e-324",
+	"2.4703282292062328e-324",
+	"1.7976931348623157e308",
+	"1e-300",
+	"1e300",
+	"1e23",
+	"0.1",
+	"0.30000000000000004",
+	"9007199254740993.0",
+	"9007199254740993.0000000000000001",
+	"9223372036854775808",
+	"-9223372036854775809",
+	"123456789012345678901234567890",
+	"7.3177701707893310e+15",
+	"1.00000000000000011102230246251565404236316680908203124",
+	"1.00000000000000011102230246251565404236316680908203125",
+	"1.00000000000000011102230246251565404236316680908203126",
+	"-2.2250738585072012e-308",
+	"4.4501477170144023e-308",
+	"1e-400",
+	"-0.0",
+	"2.47032822920623272088e-324",
+	"-2.47032822920623272089e-324",
+	"0." + std::string(323, '0') + "247032822920623272088",
+	"1.7976931348623158079372897140530342e308",
+	"-1.7976931348623158079372897140530341e308",
+	"17976931348623158079372897140530342" + std::string(274, '0'),
+	"1.00000000000000011102230246251565404236316680908203125e-400",
+	"1.00000000000000011102230246251565404236316680908203125e+400",
+};
+
+/// Bits of a double, so that signed zeros and all other values compare exactly.
+uint64_t bits_of(const double value) {
+	auto bits = uint64_t{};
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+/**
+ * Check that every decimal of an array parses to the double std::strtod rounds it to, and that writing the document
+ * back as JSON keeps that double. Infinities are written as null.
+ * @param report Report to record the checks in.
+ * @param json Parsed array of the decimals.
+ * @param decimals Decimals of the array.
+ * @param description What was parsed, to report failures with.
+ */
+void check_decimals(TestReport &report, const TapedJson &json, const std::vector<std::string> &decimals,
+					const std::string &description) {
+	const auto text = json.to_json();
+	auto position = text.c_str() + 1;
+	for (const auto &decimal : decimals) {
+		const auto expected = std::strtod(decimal.c_str(), nullptr);
+		if (std::isinf(expected)) {
+			// JSON has no infinities, they are written as null.
+			report.check(std::strncmp(position, "null", 4) == 0, description + ": " + decimal + " is not infinite");
+			position += 5;
+			continue;
+		}
+		auto *end = static_cast<char *>(nullptr);
+		const auto actual = std::strtod(position, &end);
+		const auto written = std::string(position, static_cast<size_t>(end - position));
+		const auto message =
+			description + ": " + decimal + " parsed to " + written + ", expected " + shortest_decimal(expected);
+		report.check(end != position && bits_of(actual) == bits_of(expected), message);
+		position = end + 1;
+	}
+}
+
+int main() {
+	auto q = make_test_queue();
+	auto report = TestReport{};
+
+	auto all_decimals = std::string{"["};
+	for (const auto &decimal : HARD_DECIMALS) {
+		all_decimals += (all_decimals.size() > 1 ? "," : "") + decimal;
+	}
+	all_decimals += "]";
+
+	for (const auto backend : {Backend::Device, Backend::Host}) {
+		auto parser = JsonParser{q, backend};
+		const auto backend_name = std::string{backend == Backend::Device ? "device" : "host"};
+
+		for (const auto &decimal : HARD_DECIMALS) {
+			check_decimals(report, parser.parse("[" + decimal + "]"), {decimal}, backend_name);
+		}
+		check_decimals(report, parser.parse(all_decimals), HARD_DECIMALS, backend_name + " array");
+
+		// Small chunks split the long decimals, which the host then has to read across chunks.
+		auto stream = std::istringstream{all_decimals};
+		check_decimals(report, parser.parse_stream(stream, 1), HARD_DECIMALS, backend_name + " stream");
+
+		// Writing a document and parsing it again keeps every float.
+		const auto json = parser.parse(all_decimals);
+		report.check_equal(parser.parse(json.to_json()).to_json(), json.to_json(), backend_name + " round trip");
+	}
+
+	return report.finish();
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// oneAPI headers
+#include <sycl/ext/intel/fpga_extensions.hpp>
+#include <sycl/sycl.hpp>
+
+#include "exception_handler.hpp"
+#include "json_parser.hpp"
+#include "parse_error.hpp"
+
+/// Counts the failed checks of a test program, which exits with a failure if there are any.
+class TestReport {
+  public:
+	/**
+	 * Record the outcome of a check, printing it if it failed.
+	 * @param passed Whether the check passed.
+	 * @param description What was checked, e.g. the input.
+	 */
+	void check(const bool passed, const std::string &description) {
+		++_check_count;
+		if (!passed) {
+			++_failure_count;
+			std::cerr << "FAILED: " << description << "\n";
+		}
+	}
+
+	/// Check that two strings are equal.
+	void check_equal(const std::string &actual, const std::string &expected, const std::string &description) {
+		check(actual == expected, description + ": got " + actual + ", expected " + expected);
+	}
+
+	/// Print a summary and return the exit code of the test program.
+	int finish() const {
+		std::cout << _check_count - _failure_count << " of " << _check_count << " checks passed" << std::endl;
+		return _failure_count == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+  private:
+	size_t _check_count = 0;
+	size_t _failure_count = 0;
+};
+
+/// Queue on the device the tests are built for, like the one of main.cpp.
+sycl::queue make_test_queue() {
+#if FPGA_SIMULATOR
+	auto selector = sycl::ext::intel::fpga_simulator_selector_v;
+#elif FPGA_HARDWARE
+	auto selector = sycl::ext::intel::fpga_selector_v;
+#else // #if FPGA_EMULATOR
+	auto selector = sycl::ext::intel::fpga_emulator_selector_v;
+#endif
+	return sycl::queue{selector, fpga_tools::exception_handler};
+}
+
+/// The shortest decimal that reads back as the value, as TapedJson::to_json() writes it.
+std::string shortest_decimal(const double value) {
+	char digits[32];
+	const auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+	return {digits, static_cast<size_t>(end - digits)};
+}
+
+/// The error parsing a document results in, ErrorCode::None if it is valid.
+ErrorCode parse_error_code(JsonParser &parser, const std::string &input) {
+	try {
+		parser.parse(input);
+		return ErrorCode::None;
+	} catch (const ParseError &e) {
+		return e.code();
+	}
+}
+
+/**
+ * Check the outcome of parsing a document, with the document at every offset relative to the lines of the pipeline so
+ * that every sequence in it is split at every byte, and with streaming in chunks of a single line.
+ * @param report Report to record the checks in.
+ * @param parser Parser to parse with.
+ * @param document Document to parse.
+ * @param expected Error the document results in, ErrorCode::None if it is valid.
+ * @param description What is parsed, to report failures with.
+ */
+void check_document(TestReport &report, JsonParser &parser, const std::string &document, const ErrorCode expected,
+					const std::string &description) {
+	for (auto indent = size_t{0}; indent <= CACHE_LINE_SIZE; ++indent) {
+		const auto input = std::string(indent, ' ') + document;
+		report.check_equal(to_string(parse_error_code(parser, input)), to_string(expected),
+						   description + " " + document + " indented by " + std::to_string(indent));
+
+		auto stream = std::istringstream{input};
+		auto code = ErrorCode::None;
+		try {
+			parser.parse_stream(stream, 1);
+		} catch (const ParseError &e) {
+			code = e.code();
+		}
+		report.check_equal(to_string(code), to_string(expected),
+						   description + " stream " + document + " indented by " + std::to_string(indent));
+	}
+}
+
+/**
+ * Check that a valid document parses to the given JSON, at every offset relative to the lines of the pipeline and with
+ * streaming in chunks of a single line.
+ * @param report Report to record the checks in.
+ * @param parser Parser to parse with.
+ * @param document Document to parse.
+ * @param expected The parsed document as TapedJson::to_json() writes it.
+ * @param description What is parsed, to report failures with.
+ */
+void check_json(TestReport &report, JsonParser &parser, const std::string &document, const std::string &expected,
+				const std::string &description) {
+	for (auto indent = size_t{0}; indent <= CACHE_LINE_SIZE; ++indent) {
+		const auto input = std::string(indent, ' ') + document;
+		const auto where = " " + document + " indented by " + std::to_string(indent);
+		try {
+			report.check_equal(parser.parse(input).to_json(), expected, description + where);
+			auto stream = std::istringstream{input};
+			report.check_equal(parser.parse_stream(stream, 1).to_json(), expected, description + " stream" + where);
+		} catch (const ParseError &e) {
+			report.check(false, description + where + ": " + e.what());
+		}
+	}
+}
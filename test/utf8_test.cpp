@@ -0,0 +1,95 @@
+#include <string>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "parse_error.hpp"
+#include "test_utils.hpp"
+
+/// Well-formed sequences, the first and last code point of every range of Unicode Table 3-7.
+const std::vector<std::string> VALID_SEQUENCES = {
+	"\x7F",
+	"\xC2\x80",
+	"\xDF\xBF",
+	"\xE0\xA0\x80",
+	"\xE0\xBF\xBF",
+	"\xE1\x80\x80",
+	"\xEC\xBF\xBF",
+	"\xED\x80\x80",
+	"\xED\x9F\xBF",
+	"\xEE\x80\x80",
+	"\xEF\xBF\xBF",
+	"\xF0\x90\x80\x80",
+	"\xF0\xBF\xBF\xBF",
+	"\xF1\x80\x80\x80",
+	"\xF3\xBF\xBF\xBF",
+	"\xF4\x80\x80\x80",
+	"\xF4\x8F\xBF\xBF",
+};
+
+/// Ill-formed sequences: overlong forms, surrogates, code points above U+10FFFF, continuations without a first byte
+/// and sequences cut short by the next character.
+const std::vector<std::string> INVALID_SEQUENCES = {
+	// Overlong forms.
+	"\xC0\x80",
+	"\xC1\xBF",
+	"\xE0\x80\x80",
+	"\xE0\x9F\xBF",
+	"\xF0\x80\x80\x80",
+	"\xF0\x8F\xBF\xBF",
+	// Surrogates.
+	"\xED\xA0\x80",
+	"\xED\xAF\xBF",
+	"\xED\xB0\x80",
+	"\xED\xBF\xBF",
+	// Above U+10FFFF.
+	"\xF4\x90\x80\x80",
+	"\xF4\xBF\xBF\xBF",
+	"\xF5\x80\x80\x80",
+	"\xF7\xBF\xBF\xBF",
+	"\xF8\x88\x80\x80\x80",
+	"\xFF",
+	// Continuations without a first byte.
+	"\x80",
+	"\xBF",
+	"\xC3\xA9\xA9",
+	// Truncated sequences.
+	"\xC3",
+	"\xE2\x82",
+	"\xF0\x9F\x98",
+	"\xE2\x82\xC3\xA9",
+	"\xF0\x9F\x98\x20",
+};
+
+int main() {
+	auto q = make_test_queue();
+	auto report = TestReport{};
+
+	for (const auto backend : {Backend::Device, Backend::Host}) {
+		auto parser = JsonParser{q, backend};
+		const auto backend_name = std::string{backend == Backend::Device ? "device" : "host"};
+
+		// Every sequence is shifted across line and chunk boundaries, alone and next to more multibyte characters.
+		for (const auto &sequence : VALID_SEQUENCES) {
+			const auto document = "[\"" + sequence + "\",\"a" + sequence + sequence + "\"]";
+			check_json(report, parser, document, document, backend_name);
+		}
+		for (const auto &sequence : INVALID_SEQUENCES) {
+			check_document(report, parser, "[\"" + sequence + "\"]", ErrorCode::InvalidUtf8, backend_name);
+			check_document(report, parser, "[\"\xC3\xA9" + sequence + "\xC3\xA9\"]", ErrorCode::InvalidUtf8,
+						   backend_name);
+		}
+
+		// Sequences truncated by the end of the input, within a string that is unclosed as well.
+		for (const auto &truncated : {"\xC3", "\xE2\x82", "\xF0\x9F\x98"}) {
+			check_document(report, parser, std::string{"[\""} + truncated, ErrorCode::InvalidUtf8,
+						   backend_name + " end of input");
+		}
+
+		// Outside of strings, a multibyte character is an unexpected character. A byte that is never valid is found by
+		// the validator, at the same offset as by the tokenizer.
+		check_document(report, parser, "[1,\xC3\xA9]", ErrorCode::UnexpectedCharacter, backend_name);
+		check_document(report, parser, "[1,\xFF]", ErrorCode::InvalidUtf8, backend_name);
+	}
+
+	return report.finish();
+}
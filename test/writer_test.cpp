@@ -0,0 +1,108 @@
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json_parser.hpp"
+#include "test_utils.hpp"
+
+/// Documents and how TapedJson::to_json() writes them without whitespace.
+const std::vector<std::pair<std::string, std::string>> MINIFIED = {
+	{" { \"a\" : [ 1 , -2 , 3.5 ] ,\n\t\"b\" : { } , \"c\" : [ ] } ", R"({"a":[1,-2,3.5],"b":{},"c":[]})"},
+	{"[[[[]]],[{}],{\"x\":[{\"y\":null}]}]", R"([[[[]]],[{}],{"x":[{"y":null}]}])"},
+	{"\"text\"", "\"text\""},
+	{" true ", "true"},
+	{"-0.0", "-0.0"},
+	// Floats are written in the shortest form, always with a fraction or an exponent.
+	{"[1E2,0.5e-3,12345678901234567890]", "[100.0,5e-04,12345678901234567168.0]"},
+	// Quotes, backslashes and control characters are escaped, everything else is written as it is.
+	{R"(["\"\\\/\b\f\n\r\t"])", R"(["\"\\/\b\f\n\r\t"])"},
+	{R"(["\u0001\u001F\u0020\u007f"])", "[\"\\u0001\\u001f \x7F\"]"},
+	{R"({"k\"ey\n":"\u00e9\ud83d\ude00"})", "{\"k\\\"ey\\n\":\"\xC3\xA9\xF0\x9F\x98\x80\"}"},
+	// JSON has no infinities, so floats beyond the range of a double are written as null.
+	{"[1e400,-1e400,1.5]", "[null,null,1.5]"},
+	{"{\"big\":1.8e308}", "{\"big\":null}"},
+};
+
+/// A nested document and how TapedJson::to_json() writes it with JsonFormat::Pretty.
+const auto NESTED = std::string{R"({"a":[1,{},[]],"b":{"c":"d\n","e":[true,null]},"f":1e999})"};
+const auto NESTED_PRETTY = std::string{"{\n"
+									   "  \"a\": [\n"
+									   "    1,\n"
+									   "    {},\n"
+									   "    []\n"
+									   "  ],\n"
+									   "  \"b\": {\n"
+									   "    \"c\": \"d\\n\",\n"
+									   "    \"e\": [\n"
+									   "      true,\n"
+									   "      null\n"
+									   "    ]\n"
+									   "  },\n"
+									   "  \"f\": null\n"
+									   "}"};
+
+/// Documents and how TapedJson::to_json() writes them with JsonFormat::Pretty.
+const std::vector<std::pair<std::string, std::string>> PRETTY = {
+	{NESTED, NESTED_PRETTY},
+	{"[[]]", "[\n  []\n]"},
+	{"{}", "{}"},
+	{"\"\\t\"", "\"\\t\""},
+};
+
+/**
+ * Check that writing a parsed document gives the expected text, and that parsing that text again writes the same.
+ * @param report Report to record the checks in.
+ * @param parser Parser to parse with.
+ * @param document Document to parse.
+ * @param expected The document as written in the format.
+ * @param format Format to write the document in.
+ * @param description What is checked, to report failures with.
+ */
+void check_written(TestReport &report, JsonParser &parser, const std::string &document, const std::string &expected,
+				   const JsonFormat format, const std::string &description) {
+	try {
+		const auto written = parser.parse(document).to_json(format);
+		report.check_equal(written, expected, description);
+		report.check_equal(parser.parse(written).to_json(format), written, description + " round trip");
+	} catch (const ParseError &e) {
+		report.check(false, description + ": " + e.what());
+	}
+}
+
+int main() {
+	auto q = make_test_queue();
+	auto report = TestReport{};
+
+	for (const auto backend : {Backend::Device, Backend::Host}) {
+		auto parser = JsonParser{q, backend};
+		const auto backend_name = std::string{backend == Backend::Device ? "device" : "host"};
+
+		for (const auto &[document, expected] : MINIFIED) {
+			check_written(report, parser, document, expected, JsonFormat::Minified,
+						  backend_name + " minified " + document);
+		}
+		for (const auto &[document, expected] : PRETTY) {
+			check_written(report, parser, document, expected, JsonFormat::Pretty, backend_name + " pretty " + document);
+		}
+
+		// Pretty output parses back into the same document, and the indent is configurable.
+		const auto nested = std::string{R"({"a":[1,{"b":["c",{"d":[]}]}],"e":"\u0000"})"};
+		const auto json = parser.parse(nested);
+		report.check_equal(parser.parse(json.to_json(JsonFormat::Pretty)).to_json(), json.to_json(),
+						   backend_name + " pretty to minified");
+		auto os = std::ostringstream{};
+		json.write_json(os, JsonFormat::Pretty, 4);
+		report.check_equal(os.str().substr(0, 15), "{\n    \"a\": [\n  ", backend_name + " indent width");
+
+		// Output larger than the buffer of the writer is flushed in several blocks.
+		auto large = std::string{"[\""} + std::string(3 * DEFAULT_WRITE_BUFFER_SIZE, 'x') + "\"";
+		for (auto index = 0; index < 20000; ++index) {
+			large += ",\"a\\\"b\"," + std::to_string(index);
+		}
+		large += "]";
+		check_written(report, parser, large, large, JsonFormat::Minified, backend_name + " large");
+	}
+
+	return report.finish();
+}